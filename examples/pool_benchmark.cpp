@@ -0,0 +1,127 @@
+// Measures connection_pool checkout and return under contention, for the locked and sharded
+// idle list policies. Connections are stubs, so only the pool's own cost is measured.
+// Each figure is the best of several runs, taken in turn for the two policies.
+// With more threads than cores, once threads wait for connections, locked comes out 
+// ahead, which is why it stays the default.
+
+#include <sqlcons/sqlcons.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class null_connection_impl : public sqlcons::connection_impl
+{
+public:
+    void open(const std::string&, std::error_code&) override {}
+    void auto_commit(bool, std::error_code&) override {}
+    void connection_timeout(size_t, std::error_code&) override {}
+    void isolation_level(sqlcons::isolation_level, std::error_code&) override {}
+    void read_only(bool, std::error_code&) override {}
+    void catalog(const std::string&, std::error_code&) override {}
+    void reset_session(std::error_code&) override {}
+    void row_array_size(size_t) override {}
+    std::unique_ptr<sqlcons::prepared_statement_impl> prepare_statement(const std::string&, std::error_code&) override
+    {
+        return nullptr;
+    }
+    void commit(std::error_code&) override {}
+    void rollback(std::error_code&) override {}
+    void execute(const std::string&, std::error_code&) override {}
+    void execute(const std::string&,
+                 const std::function<void(const sqlcons::row&)>&,
+                 std::error_code&) override {}
+    void execute_batches(const std::string&,
+                         size_t,
+                         const std::function<void(const sqlcons::record_batch&)>&,
+                         std::error_code&) override {}
+    bool is_valid() const override
+    {
+        return true;
+    }
+};
+
+struct null_bindings
+{
+    typedef char char_type;
+
+    static std::unique_ptr<sqlcons::connection_impl> create_connection(const std::string&, std::error_code&)
+    {
+        return std::make_unique<null_connection_impl>();
+    }
+};
+
+const std::chrono::milliseconds run_time(500);
+const size_t num_runs = 3;
+
+// Checkouts per second with num_threads threads sharing a pool of pool_size connections
+template <class Policy>
+double checkouts_per_second(size_t num_threads, size_t pool_size)
+{
+    sqlcons::connection_pool<null_bindings,Policy> pool("", pool_size, pool_size);
+    pool.min_idle(pool_size);
+    std::error_code ec;
+    pool.warm_up(ec);
+
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> total{0};
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        threads.emplace_back([&]()
+        {
+            while (!start)
+            {
+                std::this_thread::yield();
+            }
+            uint64_t count = 0;
+            std::error_code ec;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                auto connection = pool.get_connection(ec);
+                if (!ec)
+                {
+                    ++count;
+                }
+            }
+            total += count;
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    start = true;
+    std::this_thread::sleep_for(run_time);
+    stop = true;
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return total / elapsed.count();
+}
+
+}
+
+int main()
+{
+    const size_t pool_size = 16;
+
+    std::printf("%8s %16s %16s\n", "threads", "locked/s", "sharded/s");
+    for (size_t num_threads = 1; num_threads <= 64; num_threads *= 2)
+    {
+        double locked = 0;
+        double sharded = 0;
+        for (size_t run = 0; run < num_runs; ++run)
+        {
+            locked = (std::max)(locked, checkouts_per_second<sqlcons::pool_policy::locked>(num_threads, pool_size));
+            sharded = (std::max)(sharded, checkouts_per_second<sqlcons::pool_policy::sharded<>>(num_threads, pool_size));
+        }
+        std::printf("%8zu %16.0f %16.0f\n", num_threads, locked, sharded);
+    }
+}
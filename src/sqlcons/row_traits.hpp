@@ -0,0 +1,80 @@
+#ifndef SQLCONS_ROW_TRAITS_HPP
+#define SQLCONS_ROW_TRAITS_HPP
+
+#include <cstddef>
+
+namespace sqlcons {
+
+// row_traits
+
+// Maps the members of a struct to result columns of the same name. 
+// Specializations are generated with SQLCONS_ROW_TRAITS_DECL.
+
+template <class T, class Enable=void>
+struct row_traits
+{
+    static constexpr bool is_mapped = false;
+};
+
+}
+
+#define SQLCONS_EXPAND(X) X
+#define SQLCONS_NARGS(...) SQLCONS_EXPAND(SQLCONS_NARGS_IMPL(__VA_ARGS__, 24,23,22,21,20,19,18,17,16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1))
+#define SQLCONS_NARGS_IMPL(_1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,_12,_13,_14,_15,_16,_17,_18,_19,_20,_21,_22,_23,_24, N, ...) N
+#define SQLCONS_CONCAT(A,B) SQLCONS_CONCAT_IMPL(A,B)
+#define SQLCONS_CONCAT_IMPL(A,B) A ## B
+
+#define SQLCONS_FOR_EACH(M, ...) SQLCONS_EXPAND(SQLCONS_CONCAT(SQLCONS_FOR_EACH_,SQLCONS_NARGS(__VA_ARGS__))(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_1(M, X) M(X)
+#define SQLCONS_FOR_EACH_2(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_1(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_3(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_2(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_4(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_3(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_5(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_4(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_6(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_5(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_7(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_6(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_8(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_7(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_9(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_8(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_10(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_9(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_11(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_10(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_12(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_11(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_13(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_12(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_14(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_13(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_15(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_14(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_16(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_15(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_17(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_16(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_18(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_17(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_19(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_18(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_20(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_19(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_21(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_20(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_22(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_21(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_23(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_22(M, __VA_ARGS__))
+#define SQLCONS_FOR_EACH_24(M, X, ...) M(X) SQLCONS_EXPAND(SQLCONS_FOR_EACH_23(M, __VA_ARGS__))
+
+#define SQLCONS_ROW_MEMBER_NAME(Member) #Member,
+#define SQLCONS_ROW_MEMBER_VISIT(Member) f(index++, val.Member);
+
+// SQLCONS_ROW_TRAITS_DECL(ValueType, member1, member2, ...)
+// Must be used at global namespace scope.
+
+#define SQLCONS_ROW_TRAITS_DECL(ValueType, ...) \
+namespace sqlcons { \
+template <> \
+struct row_traits<ValueType> \
+{ \
+    static constexpr bool is_mapped = true; \
+    static constexpr std::size_t size = SQLCONS_NARGS(__VA_ARGS__); \
+    static const char* const* member_names() \
+    { \
+        static const char* const names[] = {SQLCONS_FOR_EACH(SQLCONS_ROW_MEMBER_NAME, __VA_ARGS__)}; \
+        return names; \
+    } \
+    template <class F> \
+    static void visit(ValueType& val, F&& f) \
+    { \
+        std::size_t index = 0; \
+        SQLCONS_FOR_EACH(SQLCONS_ROW_MEMBER_VISIT, __VA_ARGS__) \
+    } \
+}; \
+}
+
+#endif
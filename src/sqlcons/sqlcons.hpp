@@ -2,15 +2,34 @@
 #define SQLCONS_HPP
 
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <unordered_map>
 #include <stack>
+#include <thread>
+#include <future>
+#include <random>
 #include <memory>
 #include <system_error>
 #include <functional>
+#include <tuple>
+#include <utility>
 #include <string>
+#include <string_view>
+#include <optional>
+#include <type_traits>
 #include <vector>
 #include <map>
 #include <iostream>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
 #include <sqlcons/unicode_traits.hpp>
+#include <sqlcons/row_traits.hpp>
 #include <jsoncons/json.hpp>
 
 namespace sqlcons {
@@ -22,13 +41,159 @@ class value
 public:
     virtual ~value() = default;
 
+    virtual bool is_null() const = 0;
+
     virtual std::string as_string() const = 0;
 
     virtual std::wstring as_wstring() const = 0;
 
+    // UTF-8 text of the value, valid until the next row is fetched
+    virtual std::string_view as_string_view() const = 0;
+
+    // Appends the UTF-8 text of the value to s
+    virtual void write_to(std::string& s) const = 0;
+
     virtual double as_double() const = 0;
 
     virtual int64_t as_integer() const = 0;
+
+    template <class T>
+    T get() const
+    {
+        if constexpr (std::is_same<T,bool>::value)
+        {
+            return as_integer() != 0;
+        }
+        else if constexpr (std::is_integral<T>::value)
+        {
+            return static_cast<T>(as_integer());
+        }
+        else if constexpr (std::is_floating_point<T>::value)
+        {
+            return static_cast<T>(as_double());
+        }
+        else if constexpr (std::is_same<T,std::string_view>::value)
+        {
+            return as_string_view();
+        }
+        else if constexpr (std::is_same<T,std::string>::value)
+        {
+            return as_string();
+        }
+        else
+        {
+            static_assert(std::is_same<T,std::wstring>::value, "Unsupported value type");
+            return as_wstring();
+        }
+    }
+};
+
+// column_index
+
+// Open addressing table of result column names, built once per result set 
+// and shared by all of its rows
+class column_index
+{
+    std::vector<std::string> names_;
+    std::vector<uint32_t> slots_; // ordinal+1, 0 if empty
+    size_t mask_;
+public:
+    static const size_t npos = (std::numeric_limits<size_t>::max)();
+
+    column_index()
+        : mask_(0)
+    {
+    }
+
+    void assign(std::vector<std::string>&& names)
+    {
+        names_ = std::move(names);
+        size_t capacity = 8;
+        while (capacity < 2*names_.size())
+        {
+            capacity *= 2;
+        }
+        slots_.assign(capacity, 0);
+        mask_ = capacity - 1;
+        for (size_t i = 0; i < names_.size(); ++i)
+        {
+            size_t pos = hash(names_[i]) & mask_;
+            while (slots_[pos] != 0)
+            {
+                pos = (pos + 1) & mask_;
+            }
+            slots_[pos] = static_cast<uint32_t>(i + 1);
+        }
+    }
+
+    size_t size() const
+    {
+        return names_.size();
+    }
+
+    const std::string& name(size_t i) const
+    {
+        return names_[i];
+    }
+
+    // Position of the column with the given name, matched exactly or else 
+    // ignoring ASCII case, or npos. The first of duplicate names wins.
+    size_t find(std::string_view name) const
+    {
+        if (slots_.empty())
+        {
+            return npos;
+        }
+        size_t exact = npos;
+        size_t folded = npos;
+        for (size_t pos = hash(name) & mask_; slots_[pos] != 0; pos = (pos + 1) & mask_)
+        {
+            size_t i = slots_[pos] - 1;
+            if (names_[i] == name)
+            {
+                exact = (std::min)(exact, i);
+            }
+            else if (iequals(names_[i], name))
+            {
+                folded = (std::min)(folded, i);
+            }
+        }
+        return exact != npos ? exact : folded;
+    }
+private:
+    static char to_lower(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    static bool iequals(std::string_view a, std::string_view b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (to_lower(a[i]) != to_lower(b[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // FNV-1a over the ASCII lower case name, so that names differing only in case 
+    // share a probe sequence
+    static size_t hash(std::string_view name)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (char c : name)
+        {
+            h ^= static_cast<unsigned char>(to_lower(c));
+            h *= 1099511628211ull;
+        }
+        return static_cast<size_t>(h);
+    }
 };
 
 // row
@@ -36,12 +201,12 @@ public:
 class row
 {
     std::vector<value*> values_;
-    std::map<std::string,value*> column_map_;
+    const column_index* index_;
 public:
     typedef std::vector<value*>::iterator iterator;
 
-    row(std::vector<value*>&& values)
-        : values_(std::move(values))
+    row(std::vector<value*>&& values, const column_index* index = nullptr)
+        : values_(std::move(values)), index_(index)
     {
     }
 
@@ -62,6 +227,28 @@ public:
         return *values_[index];
     }
 
+    // Throws std::out_of_range if there is no column with the given name
+    const value& operator[](std::string_view name) const
+    {
+        const value* val = find(name);
+        if (val == nullptr)
+        {
+            throw std::out_of_range("Column not found");
+        }
+        return *val;
+    }
+
+    // Returns nullptr if there is no column with the given name
+    const value* find(std::string_view name) const
+    {
+        if (index_ == nullptr)
+        {
+            return nullptr;
+        }
+        size_t i = index_->find(name);
+        return i == column_index::npos ? nullptr : values_[i];
+    }
+
     iterator begin() 
     {
         return values_.begin();
@@ -73,521 +260,3649 @@ public:
     }
 };
 
-// parameter_base
+// column_type
+
+enum class column_type
+{
+    integer_t,
+    double_t,
+    string_t
+};
+
+// batch_column
 
-struct parameter_base
+class batch_column
 {
-    parameter_base()
-        : sql_type_identifier_(0),
-          c_type_identifier_(0)
+    std::string name_;
+    column_type type_;
+    size_t size_;
+    std::vector<int64_t> integers_;
+    std::vector<double> doubles_;
+    std::vector<uint32_t> offsets_; // size()+1 offsets into bytes_
+    std::vector<char> bytes_;       // UTF-8
+    std::vector<uint8_t> null_bitmap_; // bit i is set if row i is null
+public:
+    batch_column(std::string&& name, column_type type)
+        : name_(std::move(name)), type_(type), size_(0), offsets_(1,0)
     {
     }
-    parameter_base(int sql_type_identifier,int c_type_identifier)
-        : sql_type_identifier_(sql_type_identifier), 
-          c_type_identifier_(c_type_identifier)
+
+    const std::string& name() const
     {
+        return name_;
     }
-    virtual void* pvalue() = 0;
-
-    virtual size_t column_size() const = 0;
 
-    virtual size_t buffer_capacity() const = 0;
+    column_type type() const
+    {
+        return type_;
+    }
 
-    virtual size_t buffer_length() const = 0;
+    size_t size() const
+    {
+        return size_;
+    }
 
-    int parameter_type() const
+    // Contiguous values of an integer_t column
+    const int64_t* integers() const
     {
-        return sql_type_identifier_;
+        return integers_.data();
     }
 
-    int value_type() const
+    // Contiguous values of a double_t column
+    const double* doubles() const
     {
-        return c_type_identifier_;
+        return doubles_.data();
     }
 
-    int64_t* pind() 
+    // String i of a string_t column occupies [bytes()+offsets()[i], bytes()+offsets()[i+1])
+    const uint32_t* offsets() const
     {
-        return &ind_;
+        return offsets_.data();
     }
 
-    int64_t ind_;
-    int sql_type_identifier_;
-    int c_type_identifier_;
-};
+    const char* bytes() const
+    {
+        return bytes_.data();
+    }
 
-template <class Bindings, class T>
-struct sql_type_traits
-{
-    typedef T value_type;
-    static int sql_type_identifier();
-    static int c_type_identifier();
-};
+    const uint8_t* null_bitmap() const
+    {
+        return null_bitmap_.data();
+    }
 
-// prepared_statement_impl
+    bool is_null(size_t i) const
+    {
+        return (null_bitmap_[i >> 3] & (1 << (i & 7))) != 0;
+    }
 
-class prepared_statement_impl
-{
-public:
-    virtual ~prepared_statement_impl() = default;
+    std::string_view string_at(size_t i) const
+    {
+        return std::string_view(bytes_.data() + offsets_[i], offsets_[i+1] - offsets_[i]);
+    }
 
-    virtual void execute_(std::vector<std::unique_ptr<parameter_base>>& bindings, 
-                          const std::function<void(const row& rec)>& callback,
-                          std::error_code& ec) = 0;
+    void clear()
+    {
+        size_ = 0;
+        integers_.clear();
+        doubles_.clear();
+        offsets_.resize(1);
+        bytes_.clear();
+        null_bitmap_.clear();
+    }
 
-    virtual void execute_(std::vector<std::unique_ptr<parameter_base>>& bindings, 
-                          std::error_code& ec) = 0;
-};
+    void append_integers(const int64_t* values, size_t count)
+    {
+        integers_.insert(integers_.end(), values, values + count);
+        grow(count);
+    }
 
-// connection_impl
+    void append_doubles(const double* values, size_t count)
+    {
+        doubles_.insert(doubles_.end(), values, values + count);
+        grow(count);
+    }
 
-class connection_impl
-{
-public:
-    virtual ~connection_impl() = default;
+    template <class CharT>
+    void append_string(const CharT* s, size_t length, std::error_code& ec)
+    {
+        if constexpr (sizeof(CharT) == sizeof(char))
+        {
+            // Narrow column data is already UTF-8
+            bytes_.insert(bytes_.end(), s, s + length);
+        }
+        else
+        {
+            size_t old_size = bytes_.size();
+            auto result = unicons::transcode_append(s, s + length, bytes_);
+            if (result != unicons::conv_errc())
+            {
+                bytes_.resize(old_size);
+                ec = unicons::make_error_code(result);
+                return;
+            }
+        }
+        offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+        grow(1);
+    }
 
-    virtual void open(const std::string& connString, std::error_code& ec) = 0;
+    void append_null()
+    {
+        switch (type_)
+        {
+        case column_type::integer_t:
+            integers_.push_back(0);
+            break;
+        case column_type::double_t:
+            doubles_.push_back(0.0);
+            break;
+        case column_type::string_t:
+            offsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+            break;
+        }
+        grow(1);
+        set_null(size_-1);
+    }
 
-    virtual void auto_commit(bool val, std::error_code& ec) = 0;
+    void set_null(size_t i)
+    {
+        null_bitmap_[i >> 3] |= static_cast<uint8_t>(1 << (i & 7));
+    }
+private:
+    void grow(size_t count)
+    {
+        size_ += count;
+        null_bitmap_.resize((size_ + 7)/8, 0);
+    }
+};
 
-    virtual void connection_timeout(size_t val, std::error_code& ec) = 0;
+// record_batch
 
-    virtual std::unique_ptr<prepared_statement_impl> prepare_statement(const std::string& query, std::error_code& ec) = 0;
+class record_batch
+{
+    std::vector<batch_column> columns_;
+public:
+    typedef std::vector<batch_column>::const_iterator const_iterator;
 
-    virtual void commit(std::error_code& ec) = 0;
-    virtual void rollback(std::error_code& ec) = 0;
-    virtual void execute(const std::string& query, std::error_code& ec) = 0;
-    virtual void execute(const std::string& query, 
-                         const std::function<void(const row& rec)>& callback,
-                         std::error_code& ec) = 0;
+    size_t num_columns() const
+    {
+        return columns_.size();
+    }
 
-    virtual bool is_valid() const = 0;
-};
+    size_t num_rows() const
+    {
+        return columns_.empty() ? 0 : columns_[0].size();
+    }
 
-// parameter<T>
+    const batch_column& operator[](size_t index) const
+    {
+        return columns_[index];
+    }
 
-template <class T>
-struct parameter : public parameter_base
-{
-    parameter(int sql_type_identifier,int c_type_identifier, const T& val)
-        : parameter_base(sql_type_identifier, c_type_identifier), 
-          value_(val)
+    batch_column& operator[](size_t index)
     {
+        return columns_[index];
     }
 
-    void* pvalue() override
+    const_iterator begin() const
     {
-        return &value_;
+        return columns_.begin();
     }
 
-    size_t column_size() const override
+    const_iterator end() const
     {
-        return 0;
+        return columns_.end();
     }
 
-    size_t buffer_capacity() const override
+    void add_column(std::string&& name, column_type type)
     {
-        return 0;
+        columns_.emplace_back(std::move(name), type);
     }
 
-    size_t buffer_length() const override
+    // Removes all rows but keeps the column buffers for reuse
+    void clear()
     {
-        return 0;
+        for (auto& column : columns_)
+        {
+            column.clear();
+        }
     }
+};
 
-    T value_;
+template <class Bindings, class T>
+struct sql_type_traits
+{
+    typedef T value_type;
+    static int sql_type_identifier();
+    static int c_type_identifier();
 };
 
-// parameter<std::string>
+// param_status
 
-template <>
-struct parameter<std::string> : public parameter_base
+// Outcome of one row of an array execution
+enum class param_status
 {
-    parameter(int sql_type_identifier,int c_type_identifier, const std::string& val)
-       : parameter_base(sql_type_identifier, c_type_identifier)
-   {
-       auto result1 = unicons::convert(val.begin(),val.end(),
-                                       std::back_inserter(value_), 
-                                       unicons::conv_flags::strict);
-       value_.push_back(0);
-   }
+    success,
+    success_with_info,
+    error,
+    unused,
+    diag_unavailable
+};
 
-    void* pvalue() override
+// Number of parameter rows sent per driver round trip unless otherwise specified
+
+const size_t default_paramset_size = 1000;
+
+// parameter_array_base
+
+// Column-wise parameter values, one element per row
+struct parameter_array_base
+{
+    parameter_array_base(int sql_type_identifier,int c_type_identifier)
+        : sql_type_identifier_(sql_type_identifier), 
+          c_type_identifier_(c_type_identifier)
     {
-        //std::cout << "pvalue() val: " << value_ << std::endl;
-        return &value_[0];
     }
 
-    size_t column_size() const override
+    virtual ~parameter_array_base() = default;
+
+    virtual void clear() = 0;
+
+    virtual void push_null() = 0;
+
+    // Lays out the elements for binding
+    virtual void finish() 
     {
-        return value_.size();
     }
 
-    size_t buffer_capacity() const override
+    virtual void* pvalue() = 0;
+
+    virtual size_t column_size() const = 0;
+
+    // Bytes per element
+    virtual size_t element_length() const = 0;
+
+    // Byte length of each element, negative if null, or nullptr if no element is null
+    virtual const int64_t* lengths() const = 0;
+
+    int parameter_type() const
     {
-        return (value_.size()-1)*sizeof(wchar_t);
+        return sql_type_identifier_;
     }
 
-    size_t buffer_length() const override
+    int value_type() const
     {
-        return (value_.size()-1)*sizeof(wchar_t);
+        return c_type_identifier_;
     }
 
-    std::vector<wchar_t> value_;
+    int sql_type_identifier_;
+    int c_type_identifier_;
 };
 
-namespace transaction_rule {
+// parameter_array<T>
 
-class transaction
+template <class T>
+struct parameter_array : public parameter_array_base
 {
-public:
-    virtual bool fail() const = 0;
+    parameter_array(int sql_type_identifier,int c_type_identifier)
+        : parameter_array_base(sql_type_identifier, c_type_identifier), 
+          data_(nullptr), has_null_(false)
+    {
+    }
 
-    virtual void rollback() = 0;
-};
+    void clear() override
+    {
+        values_.clear();
+        lengths_.clear();
+        data_ = nullptr;
+        has_null_ = false;
+    }
 
-class auto_commit : public virtual transaction
-{
-public:
-    auto_commit() = default;
-    auto_commit(const auto_commit&) = default;
-    auto_commit(auto_commit&& other) = default;
+    // Binds the caller's elements in place
+    void assign(const T* data)
+    {
+        clear();
+        data_ = data;
+    }
 
-    bool is_auto_commit() const
+    void push_back(T val)
     {
-        return true;
+        values_.push_back(val);
+        lengths_.push_back(sizeof(T));
     }
 
-    bool fail() const override
+    void push_null() override
     {
-        return false;
+        values_.push_back(T());
+        lengths_.push_back(-1);
+        has_null_ = true;
     }
 
-    void rollback() override
+    void* pvalue() override
     {
+        return data_ != nullptr ? const_cast<T*>(data_) : values_.data();
     }
 
-    void init(connection_impl* pimpl, std::error_code& ec) 
+    size_t column_size() const override
     {
-        pimpl->auto_commit(true,ec);
+        return 0;
     }
 
-    void end_transaction(connection_impl* pimpl, std::error_code& ec) 
+    size_t element_length() const override
+    {
+        return sizeof(T);
+    }
+
+    const int64_t* lengths() const override
     {
+        return has_null_ ? lengths_.data() : nullptr;
     }
+
+    std::vector<T> values_;
+    std::vector<int64_t> lengths_;
+    const T* data_;
+    bool has_null_;
 };
 
-class all_or_none : public virtual transaction
+// text_parameter_array<CharT>
+
+// Text elements as UTF-16 code units, or as UTF-8 bytes when CharT is char
+template <class CharT>
+struct text_parameter_array : public parameter_array_base
 {
-    bool rollback_;
+    text_parameter_array(int sql_type_identifier,int c_type_identifier)
+        : parameter_array_base(sql_type_identifier, c_type_identifier), 
+          offsets_{0}, width_(1)
+    {
+    }
+
+    void clear() override
+    {
+        text_.clear();
+        offsets_.assign(1, 0);
+        lengths_.clear();
+        values_.clear();
+        width_ = 1;
+    }
+
+    void push_back(std::string_view val)
+    {
+        if constexpr (sizeof(CharT) == sizeof(char))
+        {
+            text_.insert(text_.end(), val.begin(), val.end());
+        }
+        else
+        {
+            unicons::transcode_append(val.data(), val.data() + val.size(), text_);
+        }
+        size_t len = text_.size() - offsets_.back();
+        offsets_.push_back(text_.size());
+        lengths_.push_back(static_cast<int64_t>(len*sizeof(CharT)));
+    }
+
+    void push_null() override
+    {
+        offsets_.push_back(text_.size());
+        lengths_.push_back(-1);
+    }
+
+    // Copies the elements into fixed width, null terminated slots
+    void finish() override
+    {
+        size_t max_length = 0;
+        for (size_t i = 1; i < offsets_.size(); ++i)
+        {
+            max_length = (std::max)(max_length, offsets_[i] - offsets_[i-1]);
+        }
+        width_ = max_length + 1;
+        values_.assign((offsets_.size()-1)*width_, 0);
+        for (size_t i = 1; i < offsets_.size(); ++i)
+        {
+            std::copy(text_.begin() + offsets_[i-1], text_.begin() + offsets_[i], values_.begin() + (i-1)*width_);
+        }
+    }
+
+    void* pvalue() override
+    {
+        return values_.data();
+    }
+
+    size_t column_size() const override
+    {
+        return width_ > 1 ? width_ - 1 : 1;
+    }
+
+    size_t element_length() const override
+    {
+        return width_*sizeof(CharT);
+    }
+
+    const int64_t* lengths() const override
+    {
+        return lengths_.data();
+    }
+
+    std::vector<CharT> text_;
+    std::vector<size_t> offsets_;
+    std::vector<int64_t> lengths_;
+    std::vector<CharT> values_;
+    size_t width_;
+};
+
+// parameter_binding
+
+// A parameter value in caller storage, bound for one execution
+struct parameter_binding
+{
+    int sql_type_identifier;
+    int c_type_identifier;
+    const void* value;  // nullptr for a null value
+    size_t length;      // bytes at value
+    size_t column_size;
+    bool is_text;       // value is UTF-8, transcoded by the bindings to c_type_identifier
+};
+
+// Number of rows fetched per driver round trip unless otherwise specified
+
+const size_t default_row_array_size = 100;
+
+// column_binding
+
+struct column_binding
+{
+    size_t column;
+    int c_type_identifier;
+    void* buffer;
+    size_t buffer_length;
+};
+
+// statement_metadata
+
+// Parameter markers and result columns of a prepared statement, as described by the driver
+struct statement_metadata
+{
+    size_t num_parameters = 0;
+    std::vector<std::string> column_names; // UTF-8
+};
+
+// prepared_statement_impl
+
+class prepared_statement_impl
+{
+public:
+    virtual ~prepared_statement_impl() = default;
+
+    virtual void row_array_size(size_t val) = 0;
+
+    virtual void execute_(const parameter_binding* params, size_t count,
+                          const std::function<void(const row& rec)>& callback,
+                          std::error_code& ec) = 0;
+
+    virtual void execute_(const parameter_binding* params, size_t count,
+                          std::error_code& ec) = 0;
+
+    virtual void execute_batches_(const parameter_binding* params, size_t count,
+                                  size_t batch_size,
+                                  const std::function<void(const record_batch& batch)>& callback,
+                                  std::error_code& ec) = 0;
+
+    // Executes once for each of count rows of parameter arrays, in one round trip
+    virtual void execute_array_(std::vector<std::unique_ptr<parameter_array_base>>& columns, 
+                                size_t count,
+                                param_status* status,
+                                std::error_code& ec) = 0;
+
+    // Cursor over the result of execute_ with columns bound to caller storage.
+    // Columns 1 to count are bound, any remaining columns are retrieved with
+    // get_data_ or get_string_ after each fetch, in column order.
+
+    virtual void bind_columns_(const column_binding* columns, size_t count, std::error_code& ec) = 0;
+
+    virtual bool fetch_(std::error_code& ec) = 0;
+
+    virtual void get_data_(size_t column, int c_type_identifier, void* buffer, size_t buffer_length, std::error_code& ec) = 0;
+
+    virtual void get_string_(size_t column, std::string& s, std::error_code& ec) = 0;
+
+    virtual void close_cursor_() = 0;
+
+    // Readies the statement for reuse from a statement_cache: closes an open cursor,
+    // unbinds columns bound to caller storage, and restores the row array size
+    virtual void reset_() = 0;
+
+    // Describes and binds the result columns again on the next execution
+    virtual void refresh_columns_() = 0;
+
+    virtual void describe_(statement_metadata& metadata, std::error_code& ec) = 0;
+
+    // Ordinal of the result column with the given name
+    virtual size_t column_index_(std::string_view name, std::error_code& ec) = 0;
+};
+
+namespace detail {
+
+// column_binder
+
+template <class Bindings, class T, class Enable=void>
+struct column_binder
+{
+};
+
+template <class Bindings, class T>
+struct column_binder<Bindings,T,typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T,bool>::value>::type>
+{
+    static constexpr bool is_bindable = true;
+
+    static column_binding binding(size_t column, T& val)
+    {
+        return column_binding{column, sql_type_traits<Bindings,T>::c_type_identifier(), &val, sizeof(T)};
+    }
+
+    static void get(prepared_statement_impl& impl, size_t column, T& val, std::error_code& ec)
+    {
+        impl.get_data_(column, sql_type_traits<Bindings,T>::c_type_identifier(), &val, sizeof(T), ec);
+    }
+};
+
+template <class Bindings>
+struct column_binder<Bindings,std::string>
+{
+    static constexpr bool is_bindable = false;
+
+    static column_binding binding(size_t column, std::string&)
+    {
+        return column_binding{column, 0, nullptr, 0};
+    }
+
+    static void get(prepared_statement_impl& impl, size_t column, std::string& val, std::error_code& ec)
+    {
+        impl.get_string_(column, val, ec);
+    }
+};
+
+// tuple_binder
+
+template <class Bindings, class Tuple>
+struct tuple_binder
+{
+};
+
+template <class Bindings, class... Ts>
+struct tuple_binder<Bindings,std::tuple<Ts...>>
+{
+    static_assert(sizeof...(Ts) > 0, "Row tuple must have at least one element");
+
+    // Elements up to the first one that cannot be bound are bound to their
+    // columns, the rest are retrieved after each fetch
+    static constexpr size_t bound_count()
+    {
+        constexpr bool bindable[] = {column_binder<Bindings,Ts>::is_bindable..., false};
+        size_t n = 0;
+        while (bindable[n])
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    static void bind(prepared_statement_impl& impl, std::tuple<Ts...>& t, std::error_code& ec)
+    {
+        bind(impl, t, ec, std::index_sequence_for<Ts...>());
+    }
+
+    static void get(prepared_statement_impl& impl, std::tuple<Ts...>& t, std::error_code& ec)
+    {
+        get(impl, t, ec, std::index_sequence_for<Ts...>());
+    }
+private:
+    template <std::size_t... I>
+    static void bind(prepared_statement_impl& impl, std::tuple<Ts...>& t, std::error_code& ec, std::index_sequence<I...>)
+    {
+        column_binding columns[] = {column_binder<Bindings,Ts>::binding(I+1, std::get<I>(t))...};
+        impl.bind_columns_(columns, bound_count(), ec);
+    }
+
+    template <std::size_t... I>
+    static void get(prepared_statement_impl& impl, std::tuple<Ts...>& t, std::error_code& ec, std::index_sequence<I...>)
+    {
+        ((I >= bound_count() && !ec ? column_binder<Bindings,Ts>::get(impl, I+1, std::get<I>(t), ec) : void()), ...);
+    }
+};
+
+// column_map
+
+// Result column ordinals of the members of a mapped struct, resolved once per statement
+struct column_map
+{
+    const void* key;
+    std::vector<size_t> ordinals;
+    // Columns from this ordinal on are retrieved after each fetch
+    size_t unbound_from;
+};
+
+// column_getter
+
+struct column_getter
+{
+    size_t column;
+    void* member;
+    void (*get)(prepared_statement_impl& impl, size_t column, void* member, std::error_code& ec);
+
+    bool operator<(const column_getter& other) const
+    {
+        return column < other.column;
+    }
+};
+
+template <class Bindings, class T>
+void get_member(prepared_statement_impl& impl, size_t column, void* member, std::error_code& ec)
+{
+    column_binder<Bindings,T>::get(impl, column, *static_cast<T*>(member), ec);
+}
+
+// struct_binder
+
+template <class Bindings, class T>
+class struct_binder
+{
+    static constexpr size_t size = row_traits<T>::size;
+
+    const column_map& map_;
+    std::array<column_getter,size> getters_;
+    size_t getter_count_;
+public:
+    struct_binder(const column_map& map)
+        : map_(map), getter_count_(0)
+    {
+    }
+
+    static void make_column_map(prepared_statement_impl& impl, const void* key, column_map& map, std::error_code& ec)
+    {
+        map.key = key;
+        map.unbound_from = (std::numeric_limits<size_t>::max)();
+        const char* const* names = row_traits<T>::member_names();
+        for (size_t i = 0; i < size; ++i)
+        {
+            map.ordinals.push_back(impl.column_index_(names[i], ec));
+            if (ec)
+            {
+                return;
+            }
+        }
+        T val{};
+        row_traits<T>::visit(val, [&](size_t index, auto& member)
+        {
+            typedef column_binder<Bindings,typename std::decay<decltype(member)>::type> binder;
+            if (!binder::is_bindable)
+            {
+                map.unbound_from = (std::min)(map.unbound_from, map.ordinals[index]);
+            }
+        });
+    }
+
+    void bind(prepared_statement_impl& impl, T& val, std::error_code& ec)
+    {
+        std::array<column_binding,size> columns;
+        size_t count = 0;
+        getter_count_ = 0;
+        row_traits<T>::visit(val, [&](size_t index, auto& member)
+        {
+            typedef typename std::decay<decltype(member)>::type member_type;
+            typedef column_binder<Bindings,member_type> binder;
+            size_t column = map_.ordinals[index];
+            if (binder::is_bindable && column < map_.unbound_from)
+            {
+                columns[count++] = binder::binding(column, member);
+            }
+            else
+            {
+                getters_[getter_count_++] = column_getter{column, &member, &get_member<Bindings,member_type>};
+            }
+        });
+        std::sort(getters_.begin(), getters_.begin() + getter_count_);
+        impl.bind_columns_(columns.data(), count, ec);
+    }
+
+    void get(prepared_statement_impl& impl, T&, std::error_code& ec)
+    {
+        for (size_t i = 0; i < getter_count_ && !ec; ++i)
+        {
+            getters_[i].get(impl, getters_[i].column, getters_[i].member, ec);
+        }
+    }
+};
+
+// scalar_value
+
+union scalar_value
+{
+    int64_t i;
+    uint64_t u;
+    double d;
+};
+
+// parameter_binder
+
+// Describes a value of type T as a parameter_binding, chosen at compile time
+template <class Bindings, class T, class Enable=void>
+struct parameter_binder
+{
+    static_assert(std::is_arithmetic<T>::value, "Unsupported parameter type");
+
+    static parameter_binding binding(const T& val)
+    {
+        return parameter_binding{sql_type_traits<Bindings,T>::sql_type_identifier(), 
+                                 sql_type_traits<Bindings,T>::c_type_identifier(),
+                                 &val, sizeof(T), 0, false};
+    }
+};
+
+template <class Bindings>
+struct parameter_binder<Bindings,bool>
+{
+    static parameter_binding binding(bool val)
+    {
+        static const char digits[] = "01";
+        return parameter_binding{sql_type_traits<Bindings,bool>::sql_type_identifier(), 
+                                 sql_type_traits<Bindings,bool>::c_type_identifier(),
+                                 &digits[val ? 1 : 0], 1, 1, false};
+    }
+};
+
+template <class Bindings>
+struct parameter_binder<Bindings,std::string_view>
+{
+    static parameter_binding binding(std::string_view val)
+    {
+        return parameter_binding{sql_type_traits<Bindings,std::string>::sql_type_identifier(), 
+                                 sql_type_traits<Bindings,std::string>::c_type_identifier(),
+                                 val.data(), val.size(), 0, true};
+    }
+};
+
+template <class Bindings>
+struct parameter_binder<Bindings,std::string> : parameter_binder<Bindings,std::string_view>
+{
+};
+
+// A null pointer binds a null value
+template <class Bindings>
+struct parameter_binder<Bindings,const char*>
+{
+    static parameter_binding binding(const char* val)
+    {
+        if (val == nullptr)
+        {
+            return parameter_binder<Bindings,std::nullptr_t>::binding(nullptr);
+        }
+        return parameter_binder<Bindings,std::string_view>::binding(val);
+    }
+};
+
+template <class Bindings>
+struct parameter_binder<Bindings,char*> : parameter_binder<Bindings,const char*>
+{
+};
+
+template <class Bindings, size_t N>
+struct parameter_binder<Bindings,char[N]> : parameter_binder<Bindings,std::string_view>
+{
+};
+
+template <class Bindings>
+struct parameter_binder<Bindings,std::nullptr_t>
+{
+    static parameter_binding binding(std::nullptr_t)
+    {
+        return parameter_binding{sql_type_traits<Bindings,std::string>::sql_type_identifier(), 
+                                 sql_type_traits<Bindings,std::string>::c_type_identifier(),
+                                 nullptr, 0, 0, true};
+    }
+};
+
+template <class Bindings, class T>
+struct parameter_binder<Bindings,std::optional<T>>
+{
+    static parameter_binding binding(const std::optional<T>& val)
+    {
+        if (val)
+        {
+            return parameter_binder<Bindings,T>::binding(*val);
+        }
+        parameter_binding param = parameter_binder<Bindings,T>::binding(T());
+        param.value = nullptr;
+        param.length = 0;
+        return param;
+    }
+};
+
+template <class Bindings, class Tuple, std::size_t... I>
+std::array<parameter_binding,sizeof...(I)> make_parameter_bindings(const Tuple& parameters, std::index_sequence<I...>)
+{
+    return std::array<parameter_binding,sizeof...(I)>{{parameter_binder<Bindings,typename std::decay<typename std::tuple_element<I,Tuple>::type>::type>::binding(std::get<I>(parameters))...}};
+}
+
+// column_array
+
+// Fills a parameter array from rows [offset, offset+count) of a std::vector<T>
+template <class Bindings, class T, class Enable=void>
+struct column_array
+{
+    static std::unique_ptr<parameter_array_base> make()
+    {
+        return std::make_unique<parameter_array<T>>(sql_type_traits<Bindings,T>::sql_type_identifier(), 
+                                                    sql_type_traits<Bindings,T>::c_type_identifier());
+    }
+
+    static void assign(parameter_array_base& column, const std::vector<T>& values, size_t offset, size_t)
+    {
+        static_cast<parameter_array<T>&>(column).assign(values.data() + offset);
+    }
+};
+
+// std::vector<bool> is packed, so its elements are copied as int16_t
+template <class Bindings>
+struct column_array<Bindings,bool>
+{
+    static std::unique_ptr<parameter_array_base> make()
+    {
+        return column_array<Bindings,int16_t>::make();
+    }
+
+    static void assign(parameter_array_base& column, const std::vector<bool>& values, size_t offset, size_t count)
+    {
+        auto& array = static_cast<parameter_array<int16_t>&>(column);
+        array.clear();
+        for (size_t i = offset; i < offset + count; ++i)
+        {
+            array.push_back(values[i] ? 1 : 0);
+        }
+    }
+};
+
+template <class Bindings>
+struct column_array<Bindings,std::string>
+{
+    static std::unique_ptr<parameter_array_base> make()
+    {
+        return std::make_unique<text_parameter_array<typename Bindings::char_type>>(sql_type_traits<Bindings,std::string>::sql_type_identifier(), 
+                                                                                    sql_type_traits<Bindings,std::string>::c_type_identifier());
+    }
+
+    static void assign(parameter_array_base& column, const std::vector<std::string>& values, size_t offset, size_t count)
+    {
+        auto& array = static_cast<text_parameter_array<typename Bindings::char_type>&>(column);
+        array.clear();
+        for (size_t i = offset; i < offset + count; ++i)
+        {
+            array.push_back(values[i]);
+        }
+    }
+};
+
+}
+
+// statement_cache
+
+const size_t default_statement_cache_size = 32;
+
+// Prepared statements kept by a connection for reuse, keyed by SQL text, least recently 
+// used evicted first. A statement is taken out of the cache while in use and put back 
+// when done with, so a statement is never shared.
+class statement_cache
+{
+public:
+    struct entry
+    {
+        std::string query;
+        size_t hash;
+        std::unique_ptr<prepared_statement_impl> impl;
+    };
+private:
+    // Refers to the query text of an entry in lru_
+    struct key
+    {
+        std::string_view query;
+        size_t hash;
+
+        friend bool operator==(const key& a, const key& b)
+        {
+            return a.query == b.query;
+        }
+    };
+
+    struct key_hash
+    {
+        size_t operator()(const key& k) const
+        {
+            return k.hash;
+        }
+    };
+
+    size_t capacity_ = default_statement_cache_size;
+    std::list<entry> lru_; // most recently used first
+    std::unordered_map<key,std::list<entry>::iterator,key_hash> index_;
+    // Statements registered with a pool, by id, not counted against capacity
+    std::vector<std::unique_ptr<prepared_statement_impl>> registered_;
+public:
+    static size_t hash(std::string_view query)
+    {
+        return std::hash<std::string_view>()(query);
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    // 0 turns caching off
+    void capacity(size_t n)
+    {
+        capacity_ = n;
+        while (lru_.size() > capacity_)
+        {
+            evict();
+        }
+    }
+
+    size_t size() const
+    {
+        return lru_.size();
+    }
+
+    // Moves the statement for query, if there is one, out of the cache into e
+    bool take(std::string_view query, size_t hash, entry& e)
+    {
+        auto it = index_.find(key{query, hash});
+        if (it == index_.end())
+        {
+            return false;
+        }
+        auto pos = it->second;
+        index_.erase(it);
+        e = std::move(*pos);
+        lru_.erase(pos);
+        return true;
+    }
+
+    // Keeps the statement as the most recently used, 
+    // replacing a statement for the same query
+    void put(entry&& e)
+    {
+        if (capacity_ == 0)
+        {
+            return;
+        }
+        auto it = index_.find(key{e.query, e.hash});
+        if (it != index_.end())
+        {
+            auto pos = it->second;
+            index_.erase(it);
+            lru_.erase(pos);
+        }
+        else if (lru_.size() >= capacity_)
+        {
+            evict();
+        }
+        lru_.push_front(std::move(e));
+        index_.emplace(key{lru_.front().query, lru_.front().hash}, lru_.begin());
+    }
+
+    // Moves the registered statement with the given id, if prepared on this connection, into impl
+    bool take(size_t id, std::unique_ptr<prepared_statement_impl>& impl)
+    {
+        if (id >= registered_.size() || !registered_[id])
+        {
+            return false;
+        }
+        impl = std::move(registered_[id]);
+        return true;
+    }
+
+    void put(size_t id, std::unique_ptr<prepared_statement_impl>&& impl)
+    {
+        if (id >= registered_.size())
+        {
+            registered_.resize(id+1);
+        }
+        registered_[id] = std::move(impl);
+    }
+
+    void clear()
+    {
+        index_.clear();
+        lru_.clear();
+        registered_.clear();
+    }
+private:
+    void evict()
+    {
+        index_.erase(key{lru_.back().query, lru_.back().hash});
+        lru_.pop_back();
+    }
+};
+
+// isolation_level
+
+enum class isolation_level
+{
+    read_uncommitted,
+    read_committed,
+    repeatable_read,
+    serializable,
+    snapshot // SQL Server row versioning
+};
+
+// connection_impl
+
+// Session attributes are only sent to the server when they change
+
+class connection_impl
+{
+    // Shared so that a statement outliving the connection can tell the cache is gone
+    std::shared_ptr<statement_cache> statements_ = std::make_shared<statement_cache>();
+public:
+    virtual ~connection_impl() = default;
+
+    // Kept with the connection when it returns to a pool. Implementations clear it 
+    // before closing the connection.
+    statement_cache& statements()
+    {
+        return *statements_;
+    }
+
+    std::weak_ptr<statement_cache> statements_ref() const
+    {
+        return statements_;
+    }
+
+    virtual void open(const std::string& connString, std::error_code& ec) = 0;
+
+    virtual void auto_commit(bool val, std::error_code& ec) = 0;
+
+    virtual void connection_timeout(size_t val, std::error_code& ec) = 0;
+
+    virtual void isolation_level(sqlcons::isolation_level val, std::error_code& ec) = 0;
+
+    virtual void read_only(bool val, std::error_code& ec) = 0;
+
+    virtual void catalog(const std::string& val, std::error_code& ec) = 0;
+
+    // Restores the session attributes, other than auto commit, that were changed 
+    // since the connection was opened
+    virtual void reset_session(std::error_code& ec) = 0;
+
+    virtual void row_array_size(size_t val) = 0;
+
+    virtual std::unique_ptr<prepared_statement_impl> prepare_statement(const std::string& query, std::error_code& ec) = 0;
+
+    virtual void commit(std::error_code& ec) = 0;
+    virtual void rollback(std::error_code& ec) = 0;
+    virtual void execute(const std::string& query, std::error_code& ec) = 0;
+    virtual void execute(const std::string& query, 
+                         const std::function<void(const row& rec)>& callback,
+                         std::error_code& ec) = 0;
+    virtual void execute_batches(const std::string& query, 
+                                 size_t batch_size,
+                                 const std::function<void(const record_batch& batch)>& callback,
+                                 std::error_code& ec) = 0;
+
+    virtual bool is_valid() const = 0;
+};
+
+namespace transaction_rule {
+
+class transaction
+{
+public:
+    virtual bool fail() const = 0;
+
+    virtual void rollback() = 0;
+};
+
+class auto_commit : public virtual transaction
+{
+public:
+    auto_commit() = default;
+    auto_commit(const auto_commit&) = default;
+    auto_commit(auto_commit&& other) = default;
+
+    bool is_auto_commit() const
+    {
+        return true;
+    }
+
+    bool fail() const override
+    {
+        return false;
+    }
+
+    void rollback() override
+    {
+    }
+
+    void init(connection_impl* pimpl, std::error_code& ec) 
+    {
+        pimpl->auto_commit(true,ec);
+    }
+
+    void end_transaction(connection_impl* pimpl, std::error_code& ec) 
+    {
+    }
+};
+
+class all_or_none : public virtual transaction
+{
+    bool rollback_;
     bool committed_;
 public:
-    all_or_none()
-        : rollback_(false), committed_(false)
+    all_or_none()
+        : rollback_(false), committed_(false)
+    {
+    }
+    all_or_none(const all_or_none&) = default;
+    all_or_none(all_or_none&& other) = default;
+    ~all_or_none() = default;
+
+    bool is_auto_commit() const
+    {
+        return false;
+    }
+
+    bool fail() const override
+    {
+        return rollback_;
+    }
+
+    void rollback() override
+    {
+        rollback_ = true;
+    }
+
+    void init(connection_impl* pimpl, std::error_code& ec) 
+    {
+        pimpl->auto_commit(false,ec);
+    }
+
+    void end_transaction(connection_impl* pimpl, std::error_code& ec) 
+    {
+        if (!rollback_)
+        {
+            pimpl->commit(ec);
+            if (!ec)
+            {
+                committed_ = true;
+            }
+        }
+        else
+        {
+            pimpl->rollback(ec);
+            if (!ec)
+            {
+                rollback_ = false;
+            }
+        }
+    }
+};
+
+// A transaction at the given isolation level, e.g. isolated<isolation_level::serializable>.
+// The isolation level is restored when the transaction ends.
+template <isolation_level Level>
+class isolated : public all_or_none
+{
+public:
+    void init(connection_impl* pimpl, std::error_code& ec) 
+    {
+        pimpl->isolation_level(Level, ec);
+        if (!ec)
+        {
+            all_or_none::init(pimpl, ec);
+        }
+    }
+
+    void end_transaction(connection_impl* pimpl, std::error_code& ec) 
+    {
+        all_or_none::end_transaction(pimpl, ec);
+        std::error_code reset_ec;
+        pimpl->reset_session(reset_ec);
+        if (!ec)
+        {
+            ec = reset_ec;
+        }
+    }
+};
+
+// A transaction in read only access mode. With isolation_level::snapshot, or read_committed 
+// on a database with read committed snapshot on, SQL Server reads row versions and takes 
+// no shared locks. Read only mode is a hint to the driver, it does not reroute the connection 
+// to a replica.
+template <isolation_level Level>
+class read_only : public isolated<Level>
+{
+public:
+    void init(connection_impl* pimpl, std::error_code& ec) 
+    {
+        pimpl->read_only(true, ec);
+        if (!ec)
+        {
+            isolated<Level>::init(pimpl, ec);
+        }
+    }
+};
+
+typedef read_only<isolation_level::snapshot> snapshot_read;
+
+// The transaction of a group_commit batch. A failed statement does not roll back the 
+// transaction, it is noted for group_commit to roll back to the unit's savepoint.
+class grouped : public virtual transaction
+{
+    bool failed_;
+    bool aborted_;
+public:
+    grouped()
+        : failed_(false), aborted_(false)
+    {
+    }
+
+    bool is_auto_commit() const
+    {
+        return false;
+    }
+
+    bool fail() const override
+    {
+        return aborted_;
+    }
+
+    void rollback() override
+    {
+        failed_ = true;
+    }
+
+    bool failed() const
+    {
+        return failed_;
+    }
+
+    void clear_failed()
+    {
+        failed_ = false;
+    }
+
+    // Rolls back the whole transaction when it ends
+    void abort()
+    {
+        aborted_ = true;
+    }
+
+    void init(connection_impl* pimpl, std::error_code& ec) 
+    {
+        pimpl->auto_commit(false,ec);
+    }
+
+    void end_transaction(connection_impl* pimpl, std::error_code& ec) 
+    {
+        if (aborted_)
+        {
+            pimpl->rollback(ec);
+        }
+        else
+        {
+            pimpl->commit(ec);
+        }
+        failed_ = false;
+        aborted_ = false;
+    }
+};
+
+}
+
+template <class Bindings>
+class prepared_statement
+{
+    std::unique_ptr<prepared_statement_impl> pimpl_;
+    transaction_rule::transaction* tp_;
+    std::vector<detail::column_map> column_maps_;
+    size_t paramset_size_;
+    // Parameters of the last execution from JSON, reused to avoid allocating
+    std::vector<parameter_binding> params_;
+    std::vector<detail::scalar_value> values_;
+    // The connection's statement cache, and the key the statement is cached under
+    std::weak_ptr<statement_cache> cache_;
+    std::string query_;
+    size_t hash_ = 0;
+    size_t registered_id_ = unregistered;
+public:
+    static constexpr size_t unregistered = (std::numeric_limits<size_t>::max)();
+
+    prepared_statement() = delete;
+    prepared_statement(prepared_statement&&) = default;
+    prepared_statement(std::unique_ptr<prepared_statement_impl>&& pimpl, transaction_rule::transaction* tp)
+         : pimpl_(std::move(pimpl)), tp_(tp), paramset_size_(default_paramset_size) 
+    {
+    }
+    // Returns the statement to cache when destroyed
+    prepared_statement(statement_cache::entry&& e, transaction_rule::transaction* tp, std::weak_ptr<statement_cache> cache)
+         : pimpl_(std::move(e.impl)), tp_(tp), paramset_size_(default_paramset_size), 
+           cache_(std::move(cache)), query_(std::move(e.query)), hash_(e.hash)
+    {
+    }
+    // A statement registered with a pool, returned to cache by id
+    prepared_statement(std::unique_ptr<prepared_statement_impl>&& pimpl, transaction_rule::transaction* tp, 
+                       std::weak_ptr<statement_cache> cache, size_t registered_id)
+         : pimpl_(std::move(pimpl)), tp_(tp), paramset_size_(default_paramset_size), 
+           cache_(std::move(cache)), registered_id_(registered_id)
+    {
+    }
+    // Not returned if the connection, and its cache, was destroyed first
+    ~prepared_statement()
+    {
+        if (!pimpl_)
+        {
+            return;
+        }
+        auto cache = cache_.lock();
+        if (cache)
+        {
+            pimpl_->reset_();
+            if (registered_id_ != unregistered)
+            {
+                cache->put(registered_id_, std::move(pimpl_));
+            }
+            else
+            {
+                cache->put(statement_cache::entry{std::move(query_), hash_, std::move(pimpl_)});
+            }
+        }
+    }
+
+    void row_array_size(size_t val)
+    {
+        pimpl_->row_array_size(val);
+    }
+
+    // Result columns are described once and kept while their number is unchanged. 
+    // After a change that keeps the number, e.g. a column altered to another type, 
+    // this has them described again on the next execution.
+    void refresh_columns()
+    {
+        pimpl_->refresh_columns_();
+    }
+
+    // Number of parameter rows sent per round trip by execute_many
+    void paramset_size(size_t val)
+    {
+        paramset_size_ = val == 0 ? 1 : val;
+    }
+
+    void execute(const jsoncons::json& parameters,
+                 const std::function<void(const row& rec)>& callback,
+                 std::error_code& ec)
+    {
+        make_bindings(parameters);
+        execute_(params_.data(), params_.size(), callback, ec);
+    }
+
+    void execute(const jsoncons::json& parameters, std::error_code& ec)
+    {
+        make_bindings(parameters);
+        execute_(params_.data(), params_.size(), ec);
+    }
+
+    // Binds the elements of a std::tuple, e.g. std::make_tuple(id, "GOOG", 42.0), without 
+    // a JSON array or per parameter allocation. Elements may be arithmetic, strings, 
+    // std::optional or nullptr.
+    template <class... Args>
+    void execute(const std::tuple<Args...>& parameters,
+                 const std::function<void(const row& rec)>& callback,
+                 std::error_code& ec)
+    {
+        auto params = detail::make_parameter_bindings<Bindings>(parameters, std::index_sequence_for<Args...>());
+        execute_(params.data(), params.size(), callback, ec);
+    }
+
+    template <class... Args>
+    void execute(const std::tuple<Args...>& parameters, std::error_code& ec)
+    {
+        auto params = detail::make_parameter_bindings<Bindings>(parameters, std::index_sequence_for<Args...>());
+        execute_(params.data(), params.size(), ec);
+    }
+
+    // Calls f with a Row for each row of the result. A Row is either a std::tuple 
+    // of int16_t, int32_t, int64_t, uint64_t, double or std::string elements, 
+    // or a struct of such members mapped with SQLCONS_ROW_TRAITS_DECL.
+    template <class Row, class F>
+    void execute_as(const jsoncons::json& parameters, F&& f, std::error_code& ec)
+    {
+        make_bindings(parameters);
+        if (!tp_->fail())
+        {
+            if constexpr (row_traits<Row>::is_mapped)
+            {
+                const detail::column_map* map = get_column_map<Row>(ec);
+                if (!ec)
+                {
+                    detail::struct_binder<Bindings,Row> binder(*map);
+                    execute_bound<Row>(binder, f, ec);
+                }
+            }
+            else
+            {
+                detail::tuple_binder<Bindings,Row> binder;
+                execute_bound<Row>(binder, f, ec);
+            }
+            if (ec)
+            {
+                tp_->rollback();
+            }
+        }
+    }
+
+    // Appends a Row to rows for each row of the result
+    template <class Row>
+    void execute_into(const jsoncons::json& parameters, std::vector<Row>& rows, std::error_code& ec)
+    {
+        execute_as<Row>(parameters, [&rows](const Row& val){rows.push_back(val);}, ec);
+    }
+
+    // Executes once for each row of rows, a JSON array of parameter arrays. Rows are sent 
+    // paramset_size at a time, and status receives the outcome of each row.
+    void execute_many(const jsoncons::json& rows, 
+                      std::vector<param_status>& status, 
+                      std::error_code& ec)
+    {
+        status.assign(rows.size(), param_status::unused);
+        if (rows.size() == 0 || tp_->fail())
+        {
+            return;
+        }
+
+        std::vector<json_column_kind> kinds;
+        std::vector<std::unique_ptr<parameter_array_base>> columns;
+        make_parameter_arrays(rows, kinds, columns);
+
+        for (size_t offset = 0; offset < rows.size() && !ec; offset += paramset_size_)
+        {
+            size_t count = (std::min)(paramset_size_, rows.size() - offset);
+            for (size_t j = 0; j < columns.size(); ++j)
+            {
+                columns[j]->clear();
+            }
+            for (size_t i = offset; i < offset + count; ++i)
+            {
+                const jsoncons::json& row = rows[i];
+                for (size_t j = 0; j < columns.size(); ++j)
+                {
+                    if (row.is_array() && j < row.size() && !row[j].is_null())
+                    {
+                        push_back(kinds[j], *columns[j], row[j]);
+                    }
+                    else
+                    {
+                        columns[j]->push_null();
+                    }
+                }
+            }
+            execute_array(columns, count, &status[offset], ec);
+        }
+    }
+
+    void execute_many(const jsoncons::json& rows, std::error_code& ec)
+    {
+        std::vector<param_status> status;
+        execute_many(rows, status, ec);
+    }
+
+    // Executes once for each row of columns, a std::tuple of references to equally 
+    // sized std::vector columns, e.g. std::tie(ids, prices). Numeric columns are bound 
+    // in place.
+    template <class... Columns>
+    void execute_many(const std::tuple<Columns...>& columns, 
+                      std::vector<param_status>& status, 
+                      std::error_code& ec)
+    {
+        static_assert(sizeof...(Columns) > 0, "At least one parameter column is required");
+        execute_columns(columns, status, ec, std::index_sequence_for<Columns...>());
+    }
+
+    template <class... Columns>
+    void execute_many(const std::tuple<Columns...>& columns, std::error_code& ec)
+    {
+        std::vector<param_status> status;
+        execute_many(columns, status, ec);
+    }
+
+    void execute_batches(const jsoncons::json& parameters,
+                         size_t batch_size,
+                         const std::function<void(const record_batch& batch)>& callback,
+                         std::error_code& ec)
+    {
+        make_bindings(parameters);
+        if (!tp_->fail())
+        {
+            pimpl_->execute_batches_(params_.data(), params_.size(), batch_size, callback, ec);
+            if (ec)
+            {
+                tp_->rollback();
+            }
+        }
+    }
+private:
+    template <class Row, class Binder, class F>
+    void execute_bound(Binder& binder, F& f, std::error_code& ec)
+    {
+        pimpl_->execute_(params_.data(), params_.size(), ec);
+        if (!ec)
+        {
+            Row values{};
+            binder.bind(*pimpl_, values, ec);
+            while (!ec && pimpl_->fetch_(ec))
+            {
+                binder.get(*pimpl_, values, ec);
+                if (!ec)
+                {
+                    f(static_cast<const Row&>(values));
+                }
+            }
+            pimpl_->close_cursor_();
+        }
+    }
+
+    template <class Row>
+    const detail::column_map* get_column_map(std::error_code& ec)
+    {
+        const void* key = row_traits<Row>::member_names();
+        for (const auto& map : column_maps_)
+        {
+            if (map.key == key)
+            {
+                return &map;
+            }
+        }
+        detail::column_map map;
+        detail::struct_binder<Bindings,Row>::make_column_map(*pimpl_, key, map, ec);
+        if (ec)
+        {
+            return nullptr;
+        }
+        column_maps_.push_back(std::move(map));
+        return &column_maps_.back();
+    }
+
+    enum class json_column_kind {integer, floating, string};
+
+    // A column is string if any of its values is a string, floating point if any is a 
+    // double, and otherwise integer
+    static void make_parameter_arrays(const jsoncons::json& rows,
+                                      std::vector<json_column_kind>& kinds,
+                                      std::vector<std::unique_ptr<parameter_array_base>>& columns)
+    {
+        for (const auto& row : rows.array_range())
+        {
+            if (!row.is_array())
+            {
+                continue;
+            }
+            if (row.size() > kinds.size())
+            {
+                kinds.resize(row.size(), json_column_kind::integer);
+            }
+            for (size_t j = 0; j < row.size(); ++j)
+            {
+                const jsoncons::json& val = row[j];
+                if (val.is_string())
+                {
+                    kinds[j] = json_column_kind::string;
+                }
+                else if (val.is_double() && kinds[j] == json_column_kind::integer)
+                {
+                    kinds[j] = json_column_kind::floating;
+                }
+            }
+        }
+        for (auto kind : kinds)
+        {
+            switch (kind)
+            {
+            case json_column_kind::integer:
+                columns.push_back(detail::column_array<Bindings,int64_t>::make());
+                break;
+            case json_column_kind::floating:
+                columns.push_back(detail::column_array<Bindings,double>::make());
+                break;
+            case json_column_kind::string:
+                columns.push_back(detail::column_array<Bindings,std::string>::make());
+                break;
+            }
+        }
+    }
+
+    static void push_back(json_column_kind kind, parameter_array_base& column, const jsoncons::json& val)
+    {
+        switch (kind)
+        {
+        case json_column_kind::integer:
+            static_cast<parameter_array<int64_t>&>(column).push_back(val.is_bool() ? (val.as_bool() ? 1 : 0) : val.as_integer());
+            break;
+        case json_column_kind::floating:
+            static_cast<parameter_array<double>&>(column).push_back(val.as_double());
+            break;
+        case json_column_kind::string:
+            static_cast<text_parameter_array<typename Bindings::char_type>&>(column).push_back(val.as_string());
+            break;
+        }
+    }
+
+    template <class Tuple, std::size_t... I>
+    void execute_columns(const Tuple& columns, 
+                         std::vector<param_status>& status, 
+                         std::error_code& ec, 
+                         std::index_sequence<I...>)
+    {
+        const size_t sizes[] = {std::get<I>(columns).size()...};
+        size_t count = sizes[0];
+        for (size_t size : sizes)
+        {
+            if (size != count)
+            {
+                ec = std::make_error_code(std::errc::invalid_argument);
+                return;
+            }
+        }
+        status.assign(count, param_status::unused);
+        if (count == 0 || tp_->fail())
+        {
+            return;
+        }
+
+        std::vector<std::unique_ptr<parameter_array_base>> arrays;
+        arrays.reserve(sizeof...(I));
+        (arrays.push_back(detail::column_array<Bindings,typename std::decay<typename std::tuple_element<I,Tuple>::type>::type::value_type>::make()), ...);
+
+        for (size_t offset = 0; offset < count && !ec; offset += paramset_size_)
+        {
+            size_t n = (std::min)(paramset_size_, count - offset);
+            (detail::column_array<Bindings,typename std::decay<typename std::tuple_element<I,Tuple>::type>::type::value_type>::assign(*arrays[I], std::get<I>(columns), offset, n), ...);
+            execute_array(arrays, n, &status[offset], ec);
+        }
+    }
+
+    void execute_array(std::vector<std::unique_ptr<parameter_array_base>>& columns, 
+                       size_t count,
+                       param_status* status,
+                       std::error_code& ec)
+    {
+        for (auto& column : columns)
+        {
+            column->finish();
+        }
+        pimpl_->execute_array_(columns, count, status, ec);
+        if (ec)
+        {
+            tp_->rollback();
+        }
+    }
+
+    // Describes the values of a JSON array in params_, numbers are copied to values_ 
+    // and strings are referenced in place
+    void make_bindings(const jsoncons::json& parameters)
+    {
+        params_.clear();
+        if (parameters.is_array())
+        {
+            values_.resize(parameters.size());
+            size_t k = 0;
+            for (const auto& val : parameters.array_range())
+            {
+                detail::scalar_value& value = values_[k++];
+                switch (val.type_id())
+                {
+                case jsoncons::json_type_tag::null_t:
+                    params_.push_back(detail::parameter_binder<Bindings,std::nullptr_t>::binding(nullptr));
+                    break;
+                case jsoncons::json_type_tag::bool_t:
+                    params_.push_back(detail::parameter_binder<Bindings,bool>::binding(val.as_bool()));
+                    break;
+                case jsoncons::json_type_tag::uinteger_t:
+                    value.u = val.as_uinteger();
+                    params_.push_back(detail::parameter_binder<Bindings,uint64_t>::binding(value.u));
+                    break;
+                case jsoncons::json_type_tag::integer_t:
+                    value.i = val.as_integer();
+                    params_.push_back(detail::parameter_binder<Bindings,int64_t>::binding(value.i));
+                    break;
+                case jsoncons::json_type_tag::double_t:
+                    value.d = val.as_double();
+                    params_.push_back(detail::parameter_binder<Bindings,double>::binding(value.d));
+                    break;
+                case jsoncons::json_type_tag::small_string_t:
+                case jsoncons::json_type_tag::string_t:
+                {
+                    auto sv = val.as_string_view();
+                    params_.push_back(detail::parameter_binder<Bindings,std::string_view>::binding(std::string_view(sv.data(), sv.length())));
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+        }
+    }
+
+    void execute_(const parameter_binding* params, size_t count,
+                  const std::function<void(const row& rec)>& callback,
+                  std::error_code& ec)
+    {
+        if (!tp_->fail())
+        {
+            pimpl_->execute_(params, count, callback, ec);
+            if (ec)
+            {
+                tp_->rollback();
+            }
+        }
+    }
+
+    void execute_(const parameter_binding* params, size_t count,
+                  std::error_code& ec)
+    {
+        if (!tp_->fail())
+        {
+            pimpl_->execute_(params, count, ec);
+            if (ec)
+            {
+                tp_->rollback();
+            }
+        }
+    }
+};
+
+// pooled_connection
+
+namespace detail {
+
+struct pooled_connection
+{
+    std::unique_ptr<connection_impl> impl;
+    std::chrono::steady_clock::time_point created;
+    std::chrono::steady_clock::time_point idle_since;
+    std::chrono::steady_clock::time_point validated;
+};
+
+}
+
+// pool_policy
+
+// How a connection_pool stores its idle connections. A policy provides
+//     void capacity(size_t n)
+//     bool try_push(detail::pooled_connection& c)   // moves from c if there is room
+//     bool try_pop(detail::pooled_connection& c)
+//     size_t size() const
+//     void extract_if(Pred pred, std::vector<detail::pooled_connection>& removed)
+// and is safe to call from any thread.
+
+namespace pool_policy {
+
+// A LIFO list behind one mutex
+class locked
+{
+    mutable std::mutex mutex_;
+    std::vector<detail::pooled_connection> idle_; // least recently used first
+    size_t capacity_ = 0;
+public:
+    void capacity(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = n;
+        idle_.reserve(n);
+    }
+
+    bool try_push(detail::pooled_connection& c)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_.size() >= capacity_)
+        {
+            return false;
+        }
+        idle_.push_back(std::move(c));
+        return true;
+    }
+
+    bool try_pop(detail::pooled_connection& c)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_.empty())
+        {
+            return false;
+        }
+        c = std::move(idle_.back());
+        idle_.pop_back();
+        return true;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return idle_.size();
+    }
+
+    template <class Pred>
+    void extract_if(Pred pred, std::vector<detail::pooled_connection>& removed)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t n = 0;
+        for (auto& c : idle_)
+        {
+            if (pred(static_cast<const detail::pooled_connection&>(c)))
+            {
+                removed.push_back(std::move(c));
+            }
+            else
+            {
+                idle_[n++] = std::move(c);
+            }
+        }
+        idle_.resize(n);
+    }
+};
+
+// Idle connections kept on lock-free stacks, one per shard. A thread pushes to and pops from 
+// its own shard, and steals from the others when its shard is empty. Shards is the number of 
+// shards, or 0 for one per hardware thread. Not faster than locked when threads outnumber 
+// cores and wait for connections.
+template <size_t Shards = 0>
+class sharded
+{
+    // A stack head packs the top node, the number of nodes and a tag that changes with 
+    // every update, so that a node popped and pushed back meanwhile fails the compare and swap
+    static constexpr uint64_t index_bits = 20;
+    static constexpr uint64_t count_bits = 20;
+    static constexpr uint64_t index_mask = (uint64_t(1) << index_bits) - 1;
+    static constexpr uint64_t count_mask = (uint64_t(1) << count_bits) - 1;
+    static constexpr uint32_t null_index = (uint32_t)index_mask;
+
+    struct node
+    {
+        std::atomic<uint32_t> next{null_index};
+        connection_impl* impl = nullptr;
+        std::chrono::steady_clock::time_point created;
+        std::chrono::steady_clock::time_point idle_since;
+        std::chrono::steady_clock::time_point validated;
+    };
+
+    struct alignas(64) shard
+    {
+        std::atomic<uint64_t> idle{null_index}; // nodes holding connections
+        std::atomic<uint64_t> free{null_index}; // empty nodes
+    };
+
+    std::unique_ptr<node[]> nodes_;
+    std::unique_ptr<shard[]> shards_;
+    size_t num_shards_ = 0;
+
+    static uint32_t top(uint64_t head)
+    {
+        return (uint32_t)(head & index_mask);
+    }
+
+    static uint64_t count(uint64_t head)
+    {
+        return (head >> index_bits) & count_mask;
+    }
+
+    static uint64_t make_head(uint64_t old_head, uint32_t index, uint64_t count)
+    {
+        uint64_t tag = (old_head >> (index_bits + count_bits)) + 1;
+        return (tag << (index_bits + count_bits)) | (count << index_bits) | index;
+    }
+
+    static size_t thread_index()
+    {
+        static std::atomic<size_t> next{0};
+        static thread_local const size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    uint32_t pop(std::atomic<uint64_t>& stack)
+    {
+        uint64_t head = stack.load(std::memory_order_acquire);
+        while (top(head) != null_index)
+        {
+            uint32_t next = nodes_[top(head)].next.load(std::memory_order_relaxed);
+            if (stack.compare_exchange_weak(head, make_head(head, next, count(head) - 1), 
+                                            std::memory_order_acquire, std::memory_order_acquire))
+            {
+                return top(head);
+            }
+        }
+        return null_index;
+    }
+
+    void push(std::atomic<uint64_t>& stack, uint32_t index)
+    {
+        uint64_t head = stack.load(std::memory_order_relaxed);
+        do
+        {
+            nodes_[index].next.store(top(head), std::memory_order_relaxed);
+        }
+        while (!stack.compare_exchange_weak(head, make_head(head, index, count(head) + 1), 
+                                            std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Pops from the home shard's stack, or else from the other shards' in turn
+    template <class Member>
+    uint32_t steal(Member member, size_t& from)
+    {
+        size_t home = thread_index();
+        for (size_t k = 0; k < num_shards_; ++k)
+        {
+            from = (home + k) % num_shards_;
+            uint32_t index = pop(shards_[from].*member);
+            if (index != null_index)
+            {
+                return index;
+            }
+        }
+        return null_index;
+    }
+
+    void load(uint32_t index, detail::pooled_connection& c)
+    {
+        node& n = nodes_[index];
+        c.impl.reset(n.impl);
+        c.created = n.created;
+        c.idle_since = n.idle_since;
+        c.validated = n.validated;
+        n.impl = nullptr;
+    }
+
+    void store(uint32_t index, detail::pooled_connection& c)
+    {
+        node& n = nodes_[index];
+        n.impl = c.impl.release();
+        n.created = c.created;
+        n.idle_since = c.idle_since;
+        n.validated = c.validated;
+    }
+public:
+    // Up to about a million idle connections
+    static constexpr size_t max_capacity = null_index;
+
+    sharded() = default;
+    sharded(const sharded&) = delete;
+    sharded& operator=(const sharded&) = delete;
+
+    ~sharded()
+    {
+        for (size_t i = 0; i < num_shards_; ++i)
+        {
+            uint32_t index;
+            while ((index = pop(shards_[i].idle)) != null_index)
+            {
+                delete nodes_[index].impl;
+            }
+        }
+    }
+
+    // Called once, before the pool is shared between threads
+    void capacity(size_t n)
+    {
+        n = (std::min)(n, max_capacity);
+        num_shards_ = Shards != 0 ? Shards : (std::max)(std::thread::hardware_concurrency(), 1u);
+        num_shards_ = (std::max)((std::min)(num_shards_, n), size_t(1));
+        nodes_.reset(new node[n]);
+        shards_.reset(new shard[num_shards_]);
+        // Empty nodes are dealt out to the shards
+        for (size_t i = 0; i < n; ++i)
+        {
+            push(shards_[i % num_shards_].free, (uint32_t)i);
+        }
+    }
+
+    bool try_push(detail::pooled_connection& c)
+    {
+        size_t from;
+        uint32_t index = steal(&shard::free, from);
+        if (index == null_index)
+        {
+            return false;
+        }
+        store(index, c);
+        push(shards_[thread_index() % num_shards_].idle, index);
+        return true;
+    }
+
+    bool try_pop(detail::pooled_connection& c)
+    {
+        size_t from;
+        uint32_t index = steal(&shard::idle, from);
+        if (index == null_index)
+        {
+            return false;
+        }
+        load(index, c);
+        push(shards_[from].free, index);
+        return true;
+    }
+
+    size_t size() const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < num_shards_; ++i)
+        {
+            n += count(shards_[i].idle.load(std::memory_order_relaxed));
+        }
+        return n;
+    }
+
+    // Connections being examined are missing from the shard until put back, 
+    // so the pool serves waiting threads afterwards
+    template <class Pred>
+    void extract_if(Pred pred, std::vector<detail::pooled_connection>& removed)
+    {
+        for (size_t i = 0; i < num_shards_; ++i)
+        {
+            std::vector<uint32_t> kept;
+            // Not those pushed meanwhile
+            uint64_t n = count(shards_[i].idle.load(std::memory_order_relaxed));
+            uint32_t index;
+            while (n-- > 0 && (index = pop(shards_[i].idle)) != null_index)
+            {
+                detail::pooled_connection c;
+                load(index, c);
+                if (pred(static_cast<const detail::pooled_connection&>(c)))
+                {
+                    removed.push_back(std::move(c));
+                    push(shards_[i].free, index);
+                }
+                else
+                {
+                    store(index, c);
+                    kept.push_back(index);
+                }
+            }
+            // In their original order, most recently used on top
+            for (auto it = kept.rbegin(); it != kept.rend(); ++it)
+            {
+                push(shards_[i].idle, *it);
+            }
+        }
+    }
+};
+
+}
+
+// statement_registry
+
+// Statements registered with a connection pool by name, and given ids in order of registration
+class statement_registry
+{
+    struct registered_statement
+    {
+        std::string name;
+        std::string query;
+        statement_metadata metadata;
+    };
+
+    mutable std::mutex mutex_;
+    std::deque<registered_statement> statements_;
+public:
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return statements_.size();
+    }
+
+    std::optional<size_t> find(std::string_view name) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return find_(name);
+    }
+
+    // Copies the text of the statement with the given id
+    bool query(size_t id, std::string& query) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (id >= statements_.size())
+        {
+            return false;
+        }
+        query = statements_[id].query;
+        return true;
+    }
+
+    bool metadata(size_t id, statement_metadata& metadata) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (id >= statements_.size())
+        {
+            return false;
+        }
+        metadata = statements_[id].metadata;
+        return true;
+    }
+
+    // The id of name if it is registered for query, ec is set if it is registered for another query
+    std::optional<size_t> find(std::string_view name, std::string_view query, std::error_code& ec) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return find_(name, query, ec);
+    }
+
+    size_t add(const std::string& name, const std::string& query, statement_metadata&& metadata, std::error_code& ec)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto id = find_(name, query, ec);
+        if (id || ec)
+        {
+            return id ? *id : 0;
+        }
+        statements_.push_back(registered_statement{name, query, std::move(metadata)});
+        return statements_.size() - 1;
+    }
+private:
+    std::optional<size_t> find_(std::string_view name) const
+    {
+        for (size_t i = 0; i < statements_.size(); ++i)
+        {
+            if (statements_[i].name == name)
+            {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::optional<size_t> find_(std::string_view name, std::string_view query, std::error_code& ec) const
+    {
+        auto id = find_(name);
+        if (id && statements_[*id].query != query)
+        {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            return std::nullopt;
+        }
+        return id;
+    }
+};
+
+// connection_pool_base
+
+// Where a connection returns when it goes out of scope
+class connection_pool_base
+{
+protected:
+    statement_registry registry_;
+public:
+    virtual ~connection_pool_base() = default;
+
+    const statement_registry& registered_statements() const
+    {
+        return registry_;
+    }
+
+    virtual void free_connection(std::unique_ptr<connection_impl>& connection,
+                                 std::chrono::steady_clock::time_point created) = 0;
+
+    // Closes a connection that should not be reused
+    virtual void close_connection(std::unique_ptr<connection_impl>& connection) = 0;
+};
+
+// connection
+
+template <class Bindings,class Policy = pool_policy::locked>
+class connection_pool;
+
+template <class Bindings,class TP>
+class connection
+{
+    template <class B,class P>
+    friend class connection_pool;
+
+    std::unique_ptr<connection_impl> pimpl_;
+    TP transaction_policy_;
+    connection_pool_base* pool_;
+    std::chrono::steady_clock::time_point created_; // when the connection was opened
+public:
+    connection(std::unique_ptr<connection_impl> ptr, TP&& tp, connection_pool_base* pool,
+               std::chrono::steady_clock::time_point created = std::chrono::steady_clock::time_point()) 
+        : pimpl_(std::move(ptr)), transaction_policy_(std::move(tp)), pool_(pool), created_(created)
+    {
+        if (pimpl_)
+        {
+            pimpl_->row_array_size(default_row_array_size);
+        }
+    }
+    ~connection()
+    {
+        if (pimpl_)
+        {
+            std::error_code ec;
+            transaction_policy_.end_transaction(pimpl_.get(),ec);
+            pool_->free_connection(pimpl_, created_);
+        }
+    }
+
+    connection() = delete;
+    connection(const connection& other) = delete;
+
+    connection(connection&& other)
+        : pimpl_(std::move(other.pimpl_)), 
+          transaction_policy_(std::move(other.transaction_policy_)), 
+          pool_(other.pool_),
+          created_(other.created_)
+    {
+    }
+
+    void connection_timeout(size_t val, std::error_code& ec)
+    {
+        pimpl_->connection_timeout(val, ec);
+    }
+
+    // Session attributes changed here are restored when the connection returns to the pool
+
+    void isolation_level(sqlcons::isolation_level val, std::error_code& ec)
+    {
+        pimpl_->isolation_level(val, ec);
+    }
+
+    void read_only(bool val, std::error_code& ec)
+    {
+        pimpl_->read_only(val, ec);
+    }
+
+    void catalog(const std::string& val, std::error_code& ec)
+    {
+        pimpl_->catalog(val, ec);
+    }
+
+    void row_array_size(size_t val)
+    {
+        pimpl_->row_array_size(val);
+    }
+
+    void execute(const std::string& query, std::error_code& ec)
+    {
+        if (!transaction_policy_.fail())
+        {
+            pimpl_->execute(query, ec);
+            if (ec)
+            {
+                transaction_policy_.rollback();
+            }
+        }
+    }
+
+    void execute(const std::string& query, 
+                 const std::function<void(const row& rec)>& callback,
+                 std::error_code& ec)
+    {
+        if (!transaction_policy_.fail())
+        {
+            pimpl_->execute(query, callback, ec);
+            if (ec)
+            {
+                transaction_policy_.rollback();
+            }
+        }
+    }
+
+    void execute_batches(const std::string& query, 
+                         size_t batch_size,
+                         const std::function<void(const record_batch& batch)>& callback,
+                         std::error_code& ec)
+    {
+        if (!transaction_policy_.fail())
+        {
+            pimpl_->execute_batches(query, batch_size, callback, ec);
+            if (ec)
+            {
+                transaction_policy_.rollback();
+            }
+        }
+    }
+
+    // Marks the transaction to be rolled back when the connection is released
+    void rollback(std::error_code&) 
+    {
+        transaction_policy_.rollback();
+    }
+
+    // Ends the transaction, committing unless it is to be rolled back, and returns the 
+    // connection to the pool now rather than when it goes out of scope. If the commit fails, 
+    // ec is set and the transaction is rolled back.
+    void release(std::error_code& ec)
+    {
+        if (!pimpl_)
+        {
+            return;
+        }
+        transaction_policy_.end_transaction(pimpl_.get(), ec);
+        if (ec)
+        {
+            std::error_code rollback_ec;
+            pimpl_->rollback(rollback_ec);
+            if (rollback_ec || !pimpl_->is_valid())
+            {
+                pool_->close_connection(pimpl_);
+                return;
+            }
+        }
+        pool_->free_connection(pimpl_, created_);
+    }
+
+    bool is_valid() const
+    {
+        return pimpl_ && pimpl_->is_valid();
+    }
+
+    TP& transaction_policy()
+    {
+        return transaction_policy_;
+    }
+
+    // Closes the connection instead of returning it to the pool when it goes out of scope
+    void close()
+    {
+        if (pimpl_)
+        {
+            pool_->close_connection(pimpl_);
+        }
+    }
+
+    // Number of prepared statements the connection keeps for reuse, 
+    // they stay with the connection when it returns to the pool
+    void statement_cache_size(size_t val)
+    {
+        pimpl_->statements().capacity(val);
+    }
+
+    // Reuses a statement prepared earlier on this connection for the same query if there is one.
+    // The statement should be destroyed before the connection, one that outlives it is not 
+    // returned to the cache.
+    friend prepared_statement<Bindings> make_prepared_statement(connection<Bindings,TP>& conn, const std::string& query, std::error_code& ec)
+    {
+        return make_prepared_statement(conn, query, statement_cache::hash(query), ec);
+    }
+
+    // hash is statement_cache::hash(query), computed once by the caller
+    friend prepared_statement<Bindings> make_prepared_statement(connection<Bindings,TP>& conn, const std::string& query, 
+                                                                size_t hash, std::error_code& ec)
+    {
+        statement_cache& cache = conn.pimpl_->statements();
+        statement_cache::entry e;
+        if (!cache.take(query, hash, e))
+        {
+            e.impl = conn.pimpl_->prepare_statement(query, ec);
+            if (ec)
+            {
+                return prepared_statement<Bindings>(std::move(e.impl),&conn.transaction_policy_);
+            }
+            e.query = query;
+            e.hash = hash;
+        }
+        return prepared_statement<Bindings>(std::move(e),&conn.transaction_policy_,conn.pimpl_->statements_ref());
+    }
+
+    // The statement registered with the pool under id, prepared on this connection 
+    // when first used
+    friend prepared_statement<Bindings> make_prepared_statement(connection<Bindings,TP>& conn, size_t id, std::error_code& ec)
+    {
+        statement_cache& cache = conn.pimpl_->statements();
+        std::unique_ptr<prepared_statement_impl> impl;
+        if (!cache.take(id, impl))
+        {
+            std::string query;
+            if (conn.pool_ == nullptr || !conn.pool_->registered_statements().query(id, query))
+            {
+                ec = std::make_error_code(std::errc::invalid_argument);
+                return prepared_statement<Bindings>(std::move(impl),&conn.transaction_policy_);
+            }
+            impl = conn.pimpl_->prepare_statement(query, ec);
+            if (ec)
+            {
+                return prepared_statement<Bindings>(std::move(impl),&conn.transaction_policy_);
+            }
+        }
+        return prepared_statement<Bindings>(std::move(impl),&conn.transaction_policy_,conn.pimpl_->statements_ref(),id);
+    }
+};
+
+// connection_pool
+
+// How long get_connection waits for a connection when the pool is at its limit
+
+const std::chrono::milliseconds default_checkout_timeout = std::chrono::seconds(30);
+
+// How often the pool maintainer checks the idle connections
+
+const std::chrono::milliseconds default_maintenance_interval = std::chrono::seconds(1);
+
+// Idle connections above min_idle are closed after this long
+
+const std::chrono::milliseconds default_idle_timeout = std::chrono::minutes(10);
+
+// Connections are closed after this long, when next idle
+
+const std::chrono::milliseconds default_max_lifetime = std::chrono::minutes(30);
+
+// Idle connections are checked with is_valid after this long unused
+
+const std::chrono::milliseconds default_validation_interval = std::chrono::seconds(30);
+
+template <class Bindings,class Policy>
+class connection_pool : public connection_pool_base
+{
+    typedef std::chrono::steady_clock clock_type;
+    typedef detail::pooled_connection pooled_connection;
+
+    // A thread waiting in get_connection, served in arrival order
+    struct waiter
+    {
+        std::condition_variable cv;
+        pooled_connection connection; // handed over by free_connection
+        bool ready = false; // a connection, or the right to open one, was granted
+    };
+
+    std::string conn_string_;
+    Policy idle_connections_;
+    // Waiters and connection counts, off the fast path
+    std::mutex connection_pool_mutex_;
+    std::deque<waiter*> waiters_;
+    std::atomic<size_t> num_waiters_{0};
+    size_t max_pool_size_ = 0;
+    size_t max_connections_;
+    // Open connections, in use or idle, plus those being opened. Changed with the lock held.
+    std::atomic<size_t> num_connections_{0};
+    std::atomic<std::chrono::milliseconds> checkout_timeout_;
+    // Background maintainer that keeps min_idle_ connections open,
+    // and closes expired, idle and dead connections
+    std::atomic<size_t> min_idle_{0};
+    size_t num_opening_ = 0; // connections being opened for the idle list
+    std::chrono::milliseconds maintenance_interval_;
+    std::chrono::milliseconds idle_timeout_;
+    std::atomic<std::chrono::milliseconds> max_lifetime_;
+    std::chrono::milliseconds validation_interval_;
+    std::condition_variable maintenance_cv_;
+    std::condition_variable opened_cv_; // signalled when num_opening_ drops to zero
+    std::atomic<bool> wake_maintainer_{false};
+    bool stop_ = false;
+    std::thread maintainer_;
+public:
+    // pool_size limits the idle connections kept, max_connections limits the open connections
+    connection_pool(const std::string& conn_string, size_t pool_size,
+                    size_t max_connections = (std::numeric_limits<size_t>::max)())
+        : conn_string_(conn_string), max_pool_size_(pool_size),
+          max_connections_((std::max)(max_connections, size_t(1))),
+          checkout_timeout_(default_checkout_timeout),
+          maintenance_interval_(default_maintenance_interval),
+          idle_timeout_(default_idle_timeout),
+          max_lifetime_(default_max_lifetime),
+          validation_interval_(default_validation_interval)
     {
+        idle_connections_.capacity(pool_size);
+        maintainer_ = std::thread([this]() {maintain();});
     }
-    all_or_none(const all_or_none&) = default;
-    all_or_none(all_or_none&& other) = default;
-    ~all_or_none() = default;
 
-    bool is_auto_commit() const
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    ~connection_pool()
     {
-        return false;
+        {
+            std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+            stop_ = true;
+        }
+        maintenance_cv_.notify_one();
+        maintainer_.join();
     }
 
-    bool fail() const override
+    // Keeps at least val idle connections open, up to pool_size, reopening them in
+    // the background after they are taken or closed
+    void min_idle(size_t val)
     {
-        return rollback_;
+        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+        min_idle_ = (std::min)(val, max_pool_size_);
+        wake_maintainer_ = true;
+        maintenance_cv_.notify_one();
     }
 
-    void rollback() override
+    void maintenance_interval(std::chrono::milliseconds val)
+    {
+        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+        maintenance_interval_ = val;
+    }
+
+    // A zero duration turns off the corresponding check
+
+    void idle_timeout(std::chrono::milliseconds val)
+    {
+        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+        idle_timeout_ = val;
+    }
+
+    void max_lifetime(std::chrono::milliseconds val)
+    {
+        max_lifetime_ = val;
+    }
+
+    void validation_interval(std::chrono::milliseconds val)
+    {
+        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+        validation_interval_ = val;
+    }
+
+    // Opens connections until min_idle are idle, concurrently, and returns when they are open.
+    // ec is set to the error of a failed login.
+    void warm_up(std::error_code& ec)
+    {
+        ec.clear();
+        fill_idle(ec);
+
+        // Also wait for connections that the maintainer is opening
+        std::unique_lock<std::mutex> lock(connection_pool_mutex_);
+        opened_cv_.wait(lock, [this]() {return num_opening_ == 0;});
+    }
+
+    void checkout_timeout(std::chrono::milliseconds val)
+    {
+        checkout_timeout_ = val;
+    }
+
+    size_t num_connections()
+    {
+        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+        return num_connections_;
+    }
+
+    size_t num_idle_connections()
+    {
+        return idle_connections_.size();
+    }
+
+    // Registers a statement under name, and returns the id to pass to make_prepared_statement.
+    // The statement is prepared and described once here, on a pooled connection, so ec reports 
+    // invalid SQL. Connections opened by warm_up and the maintainer prepare registered statements 
+    // when they open, others when the statement is first used.
+    size_t register_statement(const std::string& name, const std::string& query, std::error_code& ec)
+    {
+        auto id = registry_.find(name, query, ec);
+        if (id || ec)
+        {
+            return id ? *id : 0;
+        }
+
+        auto conn = get_connection<transaction_rule::auto_commit>(ec);
+        if (ec)
+        {
+            return 0;
+        }
+        auto impl = conn.pimpl_->prepare_statement(query, ec);
+        if (ec)
+        {
+            return 0;
+        }
+        statement_metadata metadata;
+        impl->describe_(metadata, ec);
+        if (ec)
+        {
+            return 0;
+        }
+        size_t new_id = registry_.add(name, query, std::move(metadata), ec);
+        if (!ec)
+        {
+            conn.pimpl_->statements().put(new_id, std::move(impl));
+        }
+        return new_id;
+    }
+
+    template <class TP = transaction_rule::auto_commit>
+    connection<Bindings,TP> get_connection(std::error_code& ec)
+    {
+        return get_connection<TP>(checkout_timeout_.load(), ec);
+    }
+
+    // Waits up to timeout for a connection when max_connections are open,
+    // setting ec to std::errc::timed_out if none becomes available
+    template <class TP = transaction_rule::auto_commit>
+    connection<Bindings,TP> get_connection(std::chrono::milliseconds timeout, std::error_code& ec)
+    {
+        ec.clear();
+
+        TP tp;
+        pooled_connection conn;
+        bool open_new = false;
+        // Fast path, an idle connection when nobody is waiting
+        if (num_waiters_ == 0 && idle_connections_.try_pop(conn))
+        {
+            // The maintainer can only open more below max_connections
+            if (idle_connections_.size() < min_idle_.load(std::memory_order_relaxed) &&
+                num_connections_.load(std::memory_order_relaxed) < max_connections_)
+            {
+                wake_maintainer();
+            }
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(connection_pool_mutex_);
+            bool taken = waiters_.empty() && idle_connections_.try_pop(conn);
+            if (!taken && waiters_.empty() && num_connections_ < max_connections_)
+            {
+                ++num_connections_;
+                open_new = true;
+            }
+            else if (!taken)
+            {
+                waiter w;
+                waiters_.push_back(&w);
+                ++num_waiters_;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                // A connection may have been returned before num_waiters_ was raised
+                if (waiters_.front() == &w && idle_connections_.try_pop(conn))
+                {
+                    waiters_.pop_front();
+                    --num_waiters_;
+                }
+                else
+                {
+                    auto deadline = clock_type::now() + timeout;
+                    bool granted = w.cv.wait_until(lock, deadline, [&w]() {return w.ready;});
+                    if (!granted)
+                    {
+                        waiters_.erase(std::find(waiters_.begin(), waiters_.end(), &w));
+                        --num_waiters_;
+                        ec = std::make_error_code(std::errc::timed_out);
+                        return connection<Bindings,TP>(nullptr, std::move(tp), this);
+                    }
+                    conn = std::move(w.connection);
+                    open_new = !conn.impl;
+                }
+            }
+        }
+
+        // Logging in is a network round trip, so it is done without the lock
+        if (open_new)
+        {
+            conn.impl = Bindings::create_connection(conn_string_, ec);
+            conn.created = clock_type::now();
+        }
+        if (!ec)
+        {
+            tp.init(conn.impl.get(), ec);
+        }
+        if (ec)
+        {
+            discard_connection(std::move(conn.impl));
+            return connection<Bindings,TP>(nullptr, std::move(tp), this);
+        }
+        return connection<Bindings,TP>(std::move(conn.impl), std::move(tp), this, conn.created);
+    }
+
+    void close_connection(std::unique_ptr<connection_impl>& connection) override
+    {
+        if (connection)
+        {
+            discard_connection(std::move(connection));
+        }
+    }
+
+    // Returns a connection to the pool. Connections are validated by the maintainer,
+    // not here.
+    void free_connection(std::unique_ptr<connection_impl>& connection,
+                         clock_type::time_point created) override
+    {
+        if (!connection)
+        {
+            return;
+        }
+
+        auto now = clock_type::now();
+        std::chrono::milliseconds max_lifetime = max_lifetime_.load(std::memory_order_relaxed);
+        if (max_lifetime.count() > 0 && now - created >= max_lifetime)
+        {
+            discard_connection(std::move(connection));
+            return;
+        }
+
+        // Only attributes the borrower changed are sent, a connection 
+        // that cannot be restored is not reused
+        std::error_code ec;
+        connection->reset_session(ec);
+        if (ec)
+        {
+            discard_connection(std::move(connection));
+            return;
+        }
+
+        pooled_connection conn{std::move(connection), created, now, now};
+        if (num_waiters_ == 0)
+        {
+            // Fast path
+            if (!idle_connections_.try_push(conn))
+            {
+                discard_connection(std::move(conn.impl));
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (num_waiters_ == 0)
+            {
+                return;
+            }
+            // A thread started waiting meanwhile, pass it an idle connection
+            std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+            if (!waiters_.empty() && idle_connections_.try_pop(conn))
+            {
+                hand_over(conn);
+            }
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(connection_pool_mutex_);
+        if (hand_over(conn) || idle_connections_.try_push(conn))
+        {
+            return;
+        }
+        lock.unlock();
+        discard_connection(std::move(conn.impl));
+    }
+private:
+    void wake_maintainer()
+    {
+        if (!wake_maintainer_.exchange(true))
+        {
+            maintenance_cv_.notify_one();
+        }
+    }
+
+    // Gives a connection to the longest waiting thread, if any. Called with the lock held.
+    bool hand_over(pooled_connection& conn)
+    {
+        if (waiters_.empty())
+        {
+            return false;
+        }
+        waiter* w = waiters_.front();
+        waiters_.pop_front();
+        --num_waiters_;
+        w->connection = std::move(conn);
+        w->ready = true;
+        w->cv.notify_one();
+        return true;
+    }
+
+    // A policy's extract_if may hide idle connections while it examines them, from threads 
+    // that start waiting then, so those put back are handed to waiting threads
+    void serve_waiters()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (num_waiters_ == 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+        pooled_connection conn;
+        while (!waiters_.empty() && idle_connections_.try_pop(conn))
+        {
+            hand_over(conn);
+        }
+    }
+
+    // Closes a connection, or a failed attempt to open one, and passes its place
+    // to the longest waiting thread
+    void discard_connection(std::unique_ptr<connection_impl> connection)
+    {
+        connection.reset();
+
+        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+        release_slot(true);
+    }
+
+    // Called with the lock held
+    void release_slot(bool refill)
+    {
+        if (!waiters_.empty())
+        {
+            waiter* w = waiters_.front();
+            waiters_.pop_front();
+            --num_waiters_;
+            w->ready = true;
+            w->cv.notify_one();
+        }
+        else
+        {
+            --num_connections_;
+            if (refill && min_idle_ > 0)
+            {
+                wake_maintainer();
+            }
+        }
+    }
+
+    // Opens the connections missing from min_idle, one thread per connection,
+    // so that filling the pool takes about as long as one login
+    void fill_idle(std::error_code& ec)
+    {
+        size_t count = 0;
+        {
+            std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+            size_t idle = idle_connections_.size() + num_opening_;
+            if (min_idle_ > idle)
+            {
+                count = (std::min)(min_idle_ - idle, max_connections_ - num_connections_);
+            }
+            num_connections_ += count;
+            num_opening_ += count;
+        }
+        if (count == 0)
+        {
+            return;
+        }
+
+        std::vector<std::error_code> errors(count);
+        std::vector<std::thread> threads;
+        threads.reserve(count-1);
+        for (size_t i = 1; i < count; ++i)
+        {
+            threads.emplace_back([this,&errors,i]() {open_idle(errors[i]);});
+        }
+        open_idle(errors[0]);
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        for (const auto& e : errors)
+        {
+            if (e)
+            {
+                ec = e;
+                break;
+            }
+        }
+    }
+
+    void open_idle(std::error_code& ec)
+    {
+        auto now = clock_type::now();
+        pooled_connection conn{Bindings::create_connection(conn_string_, ec), now, now, now};
+        if (!ec)
+        {
+            prepare_registered(*conn.impl);
+        }
+
+        std::unique_lock<std::mutex> lock(connection_pool_mutex_);
+        if (--num_opening_ == 0)
+        {
+            opened_cv_.notify_all();
+        }
+        if (ec)
+        {
+            // The maintainer retries at its next interval rather than at once
+            release_slot(false);
+            lock.unlock();
+            conn.impl.reset();
+        }
+        else if (!hand_over(conn) && !idle_connections_.try_push(conn))
+        {
+            release_slot(false);
+            lock.unlock();
+            conn.impl.reset();
+        }
+    }
+
+    // A statement that fails to prepare here is prepared again, reporting the error, when used
+    void prepare_registered(connection_impl& impl)
+    {
+        std::string query;
+        for (size_t id = 0; registry_.query(id, query); ++id)
+        {
+            std::error_code ec;
+            auto statement = impl.prepare_statement(query, ec);
+            if (!ec)
+            {
+                impl.statements().put(id, std::move(statement));
+            }
+        }
+    }
+
+    // Closes idle connections that are past their lifetime or idle timeout, and checks
+    // those unused for longer than the validation interval, without holding the lock
+    // while talking to the driver
+    void evict_idle()
+    {
+        std::chrono::milliseconds idle_timeout;
+        std::chrono::milliseconds validation_interval;
+        {
+            std::lock_guard<std::mutex> lock(connection_pool_mutex_);
+            idle_timeout = idle_timeout_;
+            validation_interval = validation_interval_;
+        }
+        std::chrono::milliseconds max_lifetime = max_lifetime_;
+        auto now = clock_type::now();
+
+        std::vector<pooled_connection> closed;
+        size_t idle = idle_connections_.size();
+        size_t min_idle = min_idle_;
+        idle_connections_.extract_if([&](const pooled_connection& c) -> bool
+        {
+            bool expired = max_lifetime.count() > 0 && now - c.created >= max_lifetime;
+            bool idled_out = idle_timeout.count() > 0 && now - c.idle_since >= idle_timeout && idle > min_idle;
+            if (expired || idled_out)
+            {
+                --idle;
+                return true;
+            }
+            return false;
+        }, closed);
+        serve_waiters();
+        for (auto& c : closed)
+        {
+            discard_connection(std::move(c.impl));
+        }
+
+        if (validation_interval.count() == 0)
+        {
+            return;
+        }
+        std::vector<pooled_connection> suspect;
+        idle_connections_.extract_if([&](const pooled_connection& c) -> bool
+        {
+            return now - c.validated >= validation_interval;
+        }, suspect);
+        serve_waiters();
+        for (auto& c : suspect)
+        {
+            if (!c.impl->is_valid())
+            {
+                discard_connection(std::move(c.impl));
+                continue;
+            }
+            c.validated = clock_type::now();
+            std::unique_lock<std::mutex> lock(connection_pool_mutex_);
+            if (!hand_over(c) && !idle_connections_.try_push(c))
+            {
+                lock.unlock();
+                discard_connection(std::move(c.impl));
+            }
+        }
+    }
+
+    void maintain()
+    {
+        std::unique_lock<std::mutex> lock(connection_pool_mutex_);
+        while (!stop_)
+        {
+            wake_maintainer_ = false;
+            lock.unlock();
+            evict_idle();
+            std::error_code ec;
+            fill_idle(ec);
+            lock.lock();
+            // After a failed login, wait out the interval before trying again
+            maintenance_cv_.wait_for(lock, maintenance_interval_, [this]() {return stop_ || wake_maintainer_;});
+        }
+    }
+};
+
+// run_transaction
+
+// Counts kept by run_transaction, may be shared by threads and transactions
+struct retry_stats
+{
+    std::atomic<uint64_t> transactions{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> exhausted{0}; // failed on the last attempt with a transient error
+};
+
+struct retry_policy
+{
+    size_t max_attempts = 5;
+    // The delay before retry n is random, up to base_delay*2^(n-1), capped at max_delay
+    std::chrono::milliseconds base_delay = std::chrono::milliseconds(10);
+    std::chrono::milliseconds max_delay = std::chrono::seconds(1);
+    retry_stats* stats = nullptr;
+};
+
+namespace detail {
+
+inline std::chrono::milliseconds retry_delay(const retry_policy& policy, size_t retry)
+{
+    static thread_local std::minstd_rand engine(std::random_device{}());
+
+    auto cap = policy.max_delay.count();
+    auto delay = policy.base_delay.count();
+    for (size_t i = 1; i < retry && delay < cap; ++i)
+    {
+        delay *= 2;
+    }
+    delay = (std::min)(delay, cap);
+    if (delay <= 0)
     {
-        rollback_ = true;
+        return std::chrono::milliseconds(0);
     }
+    std::uniform_int_distribution<long long> dist(0, (long long)delay);
+    return std::chrono::milliseconds(dist(engine));
+}
 
-    void init(connection_impl* pimpl, std::error_code& ec) 
+}
+
+// Calls f(connection, ec) in a transaction of type TP and commits it. When f, or the commit, 
+// fails with an error that Bindings::is_transient reports as worth retrying, e.g. a serialization 
+// failure or deadlock, the transaction is rolled back and f is called again on another connection, 
+// after a random delay, up to policy.max_attempts times. f must be safe to call more than once.
+template <class TP = transaction_rule::all_or_none, class Bindings, class Policy, class F>
+void run_transaction(connection_pool<Bindings,Policy>& pool, const retry_policy& policy, F&& f, std::error_code& ec)
+{
+    if (policy.stats)
     {
-        pimpl->auto_commit(false,ec);
+        ++policy.stats->transactions;
     }
-
-    void end_transaction(connection_impl* pimpl, std::error_code& ec) 
+    size_t max_attempts = (std::max)(policy.max_attempts, size_t(1));
+    for (size_t attempt = 1; ; ++attempt)
     {
-        if (!rollback_)
+        ec.clear();
         {
-            pimpl->commit(ec);
+            auto conn = pool.template get_connection<TP>(ec);
             if (!ec)
             {
-                committed_ = true;
+                f(conn, ec);
+                if (!ec)
+                {
+                    conn.release(ec);
+                }
+                else
+                {
+                    std::error_code rollback_ec;
+                    conn.rollback(rollback_ec);
+                    if (!conn.is_valid())
+                    {
+                        conn.close();
+                    }
+                }
             }
         }
-        else
+        if (!ec || !Bindings::is_transient(ec))
         {
-            pimpl->rollback(ec);
-            if (!ec)
+            return;
+        }
+        if (attempt >= max_attempts)
+        {
+            if (policy.stats)
             {
-                rollback_ = false;
+                ++policy.stats->exhausted;
             }
+            return;
         }
+        if (policy.stats)
+        {
+            ++policy.stats->retries;
+        }
+        std::this_thread::sleep_for(detail::retry_delay(policy, attempt));
     }
-};
-
 }
 
-template <class Bindings>
-class prepared_statement
+// group_commit
+
+struct group_commit_options
+{
+    size_t max_batch_size = 64;
+    // How long the first unit of a batch waits for others
+    std::chrono::microseconds max_delay = std::chrono::microseconds(500);
+    // T-SQL, e.g. "SAVEPOINT sqlcons_unit" and "ROLLBACK TO SAVEPOINT sqlcons_unit" elsewhere
+    std::string savepoint = "SAVE TRANSACTION sqlcons_unit";
+    std::string rollback_to_savepoint = "ROLLBACK TRANSACTION sqlcons_unit";
+};
+
+// Runs small units of work submitted from many threads in shared transactions, so that one 
+// commit, and one log flush, serves a batch of units. Each unit runs after a savepoint, and 
+// a unit that fails is rolled back to it without affecting the others in its batch.
+template <class Bindings,class Policy = pool_policy::locked>
+class group_commit
 {
-    std::unique_ptr<prepared_statement_impl> pimpl_;
-    transaction_rule::transaction* tp_;
 public:
-    prepared_statement() = delete;
-    prepared_statement(prepared_statement&&) = default;
-    prepared_statement(std::unique_ptr<prepared_statement_impl>&& pimpl, transaction_rule::transaction* tp)
-         : pimpl_(std::move(pimpl)), tp_(tp) 
+    typedef connection<Bindings,transaction_rule::grouped> connection_type;
+    // Sets ec, or leaves a statement error in it, to have its work rolled back
+    typedef std::function<void(connection_type&, std::error_code&)> unit_type;
+private:
+    struct pending_unit
     {
+        unit_type f;
+        std::promise<std::error_code> done;
+    };
+
+    connection_pool<Bindings,Policy>& pool_;
+    group_commit_options options_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<pending_unit> queue_;
+    bool stop_ = false;
+    std::thread committer_;
+public:
+    group_commit(connection_pool<Bindings,Policy>& pool, const group_commit_options& options = group_commit_options())
+        : pool_(pool), options_(options)
+    {
+        options_.max_batch_size = (std::max)(options_.max_batch_size, size_t(1));
+        committer_ = std::thread([this]() {run();});
     }
-    ~prepared_statement() = default;
 
-    void execute(const jsoncons::json& parameters,
-                 const std::function<void(const row& rec)>& callback,
-                 std::error_code& ec)
+    group_commit(const group_commit&) = delete;
+    group_commit& operator=(const group_commit&) = delete;
+
+    // Commits the units already submitted
+    ~group_commit()
     {
-        std::vector<std::unique_ptr<parameter_base>> bindings;
-        if (parameters.is_array())
         {
-            bindings.reserve(parameters.size());
-            for (const auto& val : parameters.array_range())
-            {
-                switch (val.type_id())
-                {
-                case jsoncons::json_type_tag::bool_t:
-                    bindings.push_back(std::make_unique<parameter<bool>>(sql_type_traits<Bindings,bool>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,bool>::c_type_identifier(),
-                                       val.as_bool()));
-                    break;
-                case jsoncons::json_type_tag::uinteger_t:
-                    bindings.push_back(std::make_unique<parameter<uint64_t>>(sql_type_traits<Bindings,uint64_t>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,uint64_t>::c_type_identifier(),
-                                       val.as_integer()));
-                    break;
-                case jsoncons::json_type_tag::integer_t:
-                    bindings.push_back(std::make_unique<parameter<int64_t>>(sql_type_traits<Bindings,int64_t>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,int64_t>::c_type_identifier(),
-                                       val.as_integer()));
-                    break;
-                case jsoncons::json_type_tag::double_t:
-                    bindings.push_back(std::make_unique<parameter<double>>(sql_type_traits<Bindings,double>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,double>::c_type_identifier(),
-                                       val.as_double()));
-                    break;
-                case jsoncons::json_type_tag::small_string_t:
-                case jsoncons::json_type_tag::string_t:
-                    bindings.push_back(std::make_unique<parameter<std::string>>(sql_type_traits<Bindings,std::string>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,std::string>::c_type_identifier(),
-                                       val.as_string()));
-                    break;
-                }
-            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
         }
-        execute_(bindings,callback,ec);
+        cv_.notify_all();
+        committer_.join();
     }
 
-    void execute(const jsoncons::json& parameters, std::error_code& ec)
+    // The future becomes ready when the unit's batch has committed, with the unit's error,
+    // or the commit's, or std::errc::operation_canceled if the executor is being destroyed
+    std::future<std::error_code> submit(unit_type f)
     {
-        std::vector<std::unique_ptr<parameter_base>> bindings;
-        if (parameters.is_array())
+        pending_unit unit{std::move(f), std::promise<std::error_code>()};
+        auto result = unit.done.get_future();
+        bool notify = false;
         {
-            bindings.reserve(parameters.size());
-            for (const auto& val : parameters.array_range())
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stop_)
             {
-                switch (val.type_id())
-                {
-                case jsoncons::json_type_tag::bool_t:
-                    bindings.push_back(std::make_unique<parameter<bool>>(sql_type_traits<Bindings,bool>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,bool>::c_type_identifier(),
-                                       val.as_bool()));
-                    break;
-                case jsoncons::json_type_tag::uinteger_t:
-                    bindings.push_back(std::make_unique<parameter<uint64_t>>(sql_type_traits<Bindings,uint64_t>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,uint64_t>::c_type_identifier(),
-                                       val.as_integer()));
-                    break;
-                case jsoncons::json_type_tag::integer_t:
-                    bindings.push_back(std::make_unique<parameter<int64_t>>(sql_type_traits<Bindings,int64_t>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,int64_t>::c_type_identifier(),
-                                       val.as_integer()));
-                    break;
-                case jsoncons::json_type_tag::double_t:
-                    bindings.push_back(std::make_unique<parameter<double>>(sql_type_traits<Bindings,double>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,double>::c_type_identifier(),
-                                       val.as_double()));
-                    break;
-                case jsoncons::json_type_tag::small_string_t:
-                case jsoncons::json_type_tag::string_t:
-                    bindings.push_back(std::make_unique<parameter<std::string>>(sql_type_traits<Bindings,std::string>::sql_type_identifier(), 
-                                       sql_type_traits<Bindings,std::string>::c_type_identifier(),
-                                       val.as_string()));
-                    break;
-                }
+                unit.done.set_value(std::make_error_code(std::errc::operation_canceled));
+                return result;
             }
+            queue_.push_back(std::move(unit));
+            notify = queue_.size() == 1 || queue_.size() >= options_.max_batch_size;
+        }
+        if (notify)
+        {
+            cv_.notify_all();
         }
-        execute_(bindings,ec);
+        return result;
     }
 private:
-    void execute_(std::vector<std::unique_ptr<parameter_base>>& bindings,
-        const std::function<void(const row& rec)>& callback,
-        std::error_code& ec)
+    void run()
     {
-        if (!tp_->fail())
+        std::vector<pending_unit> batch;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
         {
-            pimpl_->execute_(bindings, callback, ec);
-            if (ec)
+            cv_.wait(lock, [this]() {return stop_ || !queue_.empty();});
+            if (queue_.empty())
             {
-                tp_->rollback();
+                return;
+            }
+            // Wait for more units, up to the delay, unless the batch is full
+            auto deadline = std::chrono::steady_clock::now() + options_.max_delay;
+            cv_.wait_until(lock, deadline, [this]() {return stop_ || queue_.size() >= options_.max_batch_size;});
+
+            size_t count = (std::min)(queue_.size(), options_.max_batch_size);
+            for (size_t i = 0; i < count; ++i)
+            {
+                batch.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+            lock.unlock();
+            while (!batch.empty())
+            {
+                commit_batch(batch);
             }
+            lock.lock();
         }
     }
-    void execute_(std::vector<std::unique_ptr<parameter_base>>& bindings,
-                  std::error_code& ec)
+
+    // Completes the units of batch, leaving in it the units to run again in a new transaction
+    // if the transaction had to be rolled back
+    void commit_batch(std::vector<pending_unit>& batch)
     {
-        if (!tp_->fail())
+        std::error_code ec;
+        auto conn = pool_.template get_connection<transaction_rule::grouped>(ec);
+        if (ec)
+        {
+            complete(batch, ec);
+            return;
+        }
+        auto& tp = conn.transaction_policy();
+
+        std::vector<std::error_code> results(batch.size());
+        size_t failed_at = batch.size(); // the unit that could not be rolled back to its savepoint
+        for (size_t i = 0; i < batch.size(); ++i)
         {
-            pimpl_->execute_(bindings, ec);
+            conn.execute(options_.savepoint, ec);
             if (ec)
             {
-                tp_->rollback();
+                // The connection is unusable, the batch fails as a whole
+                tp.abort();
+                conn.release(ec);
+                complete(batch, ec);
+                return;
+            }
+            std::error_code unit_ec;
+            batch[i].f(conn, unit_ec);
+            if (unit_ec || tp.failed())
+            {
+                results[i] = unit_ec ? unit_ec : std::make_error_code(std::errc::operation_canceled);
+                tp.clear_failed();
+                std::error_code rollback_ec;
+                conn.execute(options_.rollback_to_savepoint, rollback_ec);
+                if (rollback_ec || tp.failed())
+                {
+                    failed_at = i;
+                    break;
+                }
+            }
+        }
+
+        if (failed_at < batch.size())
+        {
+            // The failed unit doomed the transaction, run the others again without it,
+            // and without those that had failed before it
+            tp.abort();
+            std::error_code rollback_ec;
+            conn.release(rollback_ec);
+            std::vector<pending_unit> rerun;
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                if (results[i])
+                {
+                    batch[i].done.set_value(results[i]);
+                }
+                else
+                {
+                    rerun.push_back(std::move(batch[i]));
+                }
             }
+            batch.swap(rerun);
+            return;
+        }
+
+        conn.release(ec);
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            batch[i].done.set_value(results[i] ? results[i] : ec);
+        }
+        batch.clear();
+    }
+
+    static void complete(std::vector<pending_unit>& batch, const std::error_code& ec)
+    {
+        for (auto& unit : batch)
+        {
+            unit.done.set_value(ec);
         }
+        batch.clear();
     }
 };
 
-// connection
 
-template <class Bindings>
-class connection_pool;
+// async_writer
 
-template <class Bindings,class TP>
-class connection
+namespace detail {
+
+// A bounded queue that many threads push to without locking, and one thread pops from.
+// Each cell carries a sequence number that tells producers and the consumer whose turn it is.
+template <class T>
+class mpsc_queue
 {
-    std::unique_ptr<connection_impl> pimpl_;
-    TP transaction_policy_;
-    connection_pool<Bindings>* pool_;
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<cell[]> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> tail_{0}; // next position to claim
+    alignas(64) size_t head_ = 0; // next position to pop, consumer only
 public:
-    connection(std::unique_ptr<connection_impl> ptr, TP&& tp, connection_pool<Bindings>* pool) 
-        : pimpl_(std::move(ptr)), transaction_policy_(std::move(tp)), pool_(pool) 
+    // capacity is rounded up to a power of two
+    explicit mpsc_queue(size_t capacity)
     {
+        size_t n = 2;
+        while (n < capacity)
+        {
+            n *= 2;
+        }
+        cells_.reset(new cell[n]);
+        mask_ = n - 1;
+        for (size_t i = 0; i < n; ++i)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
     }
-    ~connection()
+
+    // Moves from val unless the queue is full, pos receives the position claimed for it
+    bool try_push(T& val, size_t& pos)
     {
-        std::error_code ec;
-        transaction_policy_.end_transaction(pimpl_.get(),ec);
-        pool_->free_connection(pimpl_);
+        pos = tail_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell& c = cells_[pos & mask_];
+            size_t seq = c.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+            if (diff == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    c.value = std::move(val);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
     }
 
-    connection() = delete;
-    connection(const connection& other) = delete;
+    // Positions claimed so far. Values are popped in position order, and a claimed
+    // value that is still being pushed holds back those after it.
+    size_t claimed() const
+    {
+        return tail_.load(std::memory_order_acquire);
+    }
 
-    connection(connection&& other)
-        : pimpl_(std::move(other.pimpl_))
+    // Whether try_pop would succeed
+    bool ready() const
     {
+        return cells_[head_ & mask_].sequence.load(std::memory_order_acquire) == head_ + 1;
     }
 
-    void connection_timeout(size_t val, std::error_code& ec)
+    bool try_pop(T& val)
     {
-        pimpl_->connection_timeout(val, ec);
+        cell& c = cells_[head_ & mask_];
+        size_t seq = c.sequence.load(std::memory_order_acquire);
+        if (seq != head_ + 1)
+        {
+            return false;
+        }
+        val = std::move(c.value);
+        c.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+        ++head_;
+        return true;
     }
+};
 
-    void execute(const std::string& query, std::error_code& ec)
+}
+
+struct async_writer_options
+{
+    size_t queue_capacity = 65536;
+    // Rows sent per round trip as parameter arrays, a full batch is sent at once
+    size_t batch_size = 1000;
+    // How long a row may wait for its batch to fill
+    std::chrono::milliseconds max_delay = std::chrono::milliseconds(100);
+};
+
+// Inserts rows, given as std::tuple<Columns...>, from many threads in the background, 
+// on a connection of its own, in batches bound as parameter arrays. Rows are committed 
+// as each batch executes.
+template <class Bindings,class... Columns>
+class async_writer
+{
+public:
+    typedef std::tuple<Columns...> row_type;
+private:
+    async_writer_options options_;
+    connection<Bindings,transaction_rule::auto_commit> connection_;
+    std::optional<prepared_statement<Bindings>> statement_;
+    detail::mpsc_queue<row_type> queue_;
+
+    std::atomic<bool> closed_{false};
+    std::atomic<size_t> writers_{0}; // threads in write, that may still push
+    std::atomic<size_t> num_blocked_{0}; // producers waiting for room in the queue
+    std::atomic<bool> stalled_{false}; // the flusher waits for a writer to finish
+    std::mutex mutex_;
+    std::condition_variable flush_cv_; // wakes the flusher
+    std::condition_variable room_cv_; // wakes producers when the queue has room
+    std::condition_variable written_cv_; // wakes callers of flush
+    uint64_t written_ = 0; // queue positions executed, successfully or not
+    uint64_t flush_target_ = 0; // queue position that callers of flush are waiting for
+    uint64_t failed_rows_ = 0;
+    std::error_code error_; // first error since the last flush
+    std::thread flusher_;
+public:
+    // insert is a statement with one parameter marker per column, 
+    // e.g. "INSERT INTO events(id,name,value) VALUES(?,?,?)"
+    template <class Policy>
+    async_writer(connection_pool<Bindings,Policy>& pool, const std::string& insert, 
+                 const async_writer_options& options, std::error_code& ec)
+        : options_(options), 
+          connection_(pool.get_connection(ec)),
+          queue_(options.queue_capacity)
     {
-        if (!transaction_policy_.fail())
+        options_.batch_size = (std::max)(options_.batch_size, size_t(1));
+        if (!ec)
         {
-            pimpl_->execute(query, ec);
-            if (ec)
-            {
-                transaction_policy_.rollback();
-            }
+            statement_.emplace(make_prepared_statement(connection_, insert, ec));
         }
+        if (ec)
+        {
+            closed_ = true;
+            return;
+        }
+        statement_->paramset_size(options_.batch_size);
+        flusher_ = std::thread([this]() {run();});
     }
 
-    void execute(const std::string& query, 
-                 const std::function<void(const row& rec)>& callback,
-                 std::error_code& ec)
+    async_writer(const async_writer&) = delete;
+    async_writer& operator=(const async_writer&) = delete;
+
+    ~async_writer()
     {
-        if (!transaction_policy_.fail())
+        std::error_code ec;
+        close(ec);
+    }
+
+    // Queues a row, waiting while the queue is full. 
+    // ec is set to std::errc::operation_canceled after close.
+    void write(row_type row, std::error_code& ec)
+    {
+        ++writers_;
+        if (closed_)
         {
-            pimpl_->execute(query, callback, ec);
-            if (ec)
+            leave();
+            ec = std::make_error_code(std::errc::operation_canceled);
+            return;
+        }
+        size_t pos;
+        if (!queue_.try_push(row, pos))
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++num_blocked_;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!queue_.try_push(row, pos))
             {
-                transaction_policy_.rollback();
+                flush_cv_.notify_one();
+                room_cv_.wait_for(lock, options_.max_delay);
             }
+            --num_blocked_;
         }
+        if ((pos + 1) % options_.batch_size == 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            flush_cv_.notify_one();
+        }
+        leave();
     }
 
-    void rollback(std::error_code& ec) 
+    // Queues a row unless the queue is full or the writer is closed
+    bool try_write(row_type& row)
     {
-        transaction_policy_.rollback(*pimpl_,ec);
+        ++writers_;
+        size_t pos;
+        bool pushed = !closed_ && queue_.try_push(row, pos);
+        if (pushed && (pos + 1) % options_.batch_size == 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            flush_cv_.notify_one();
+        }
+        leave();
+        return pushed;
     }
 
-    friend prepared_statement<Bindings> make_prepared_statement(connection<Bindings,TP>& conn, const std::string& query, std::error_code& ec)
+    // Waits until the rows written before the call have been executed and committed. 
+    // ec is set to the first error since the last flush.
+    void flush(std::error_code& ec)
     {
-        return prepared_statement<Bindings>(conn.pimpl_->prepare_statement(query, ec),&conn.transaction_policy_);
+        // Every position claimed by now, including those of writes still in progress
+        uint64_t target = queue_.claimed();
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (flusher_.joinable())
+        {
+            flush_target_ = (std::max)(flush_target_, target);
+            flush_cv_.notify_one();
+            written_cv_.wait(lock, [this,target]() {return written_ >= target;});
+        }
+        ec = error_;
+        error_.clear();
     }
-};
 
-// connection_pool
-
-template <class Bindings>
-class connection_pool
-{
-    std::string conn_string_;
-    std::mutex connection_pool_mutex_;
-    std::stack<std::unique_ptr<connection_impl>> free_connections_;
-    size_t max_pool_size_ = 0;
-public:
-    connection_pool(const std::string& conn_string, size_t pool_size)
-        : conn_string_(conn_string), max_pool_size_(pool_size)
+    // Stops accepting rows, writes those queued, and reports the first error since the last flush
+    void close(std::error_code& ec)
     {
+        closed_ = true;
+        if (flusher_.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                flush_cv_.notify_one();
+            }
+            flusher_.join();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        ec = error_;
+        error_.clear();
     }
 
-    template <class TP = transaction_rule::auto_commit>
-    connection<Bindings,TP> get_connection(std::error_code& ec)
+    // Rows that failed to insert, over the writer's lifetime
+    uint64_t num_failed_rows()
     {
-        ec.clear();
-
-        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
-        TP tp;
-        if (!free_connections_.empty())
+        std::lock_guard<std::mutex> lock(mutex_);
+        return failed_rows_;
+    }
+private:
+    void run()
+    {
+        std::tuple<std::vector<Columns>...> columns;
+        std::vector<param_status> status;
+        uint64_t popped = 0;
+        while (true)
         {
-            auto conn_ptr = std::move(free_connections_.top());
-            conn_ptr->auto_commit(tp.is_auto_commit(), ec);
-            free_connections_.pop();
-            return connection<Bindings,TP>(std::move(conn_ptr), std::move(tp), this);;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                flush_cv_.wait_for(lock, options_.max_delay, [&]() 
+                {
+                    return closed_ || num_blocked_ > 0 || flush_target_ > popped || 
+                           queue_.claimed() - popped >= options_.batch_size;
+                });
+            }
+            // Everything accepted so far, in batches
+            uint64_t first = popped;
+            bool drained = false;
+            while (!drained)
+            {
+                size_t n = pop(columns, options_.batch_size);
+                popped += n;
+                drained = n < options_.batch_size;
+                if (n > 0)
+                {
+                    execute(columns, status, n);
+                }
+            }
+            if (closed_ && writers_ == 0 && queue_.claimed() == popped)
+            {
+                return;
+            }
+            if (popped == first && writers_ > 0)
+            {
+                // A claimed row is still being pushed, its writer wakes us when done
+                std::unique_lock<std::mutex> lock(mutex_);
+                stalled_ = true;
+                flush_cv_.wait(lock, [this]() {return queue_.ready() || writers_ == 0;});
+                stalled_ = false;
+            }
         }
+    }
 
-        auto conn_ptr = Bindings::create_connection(conn_string_, ec);
-        conn_ptr->auto_commit(tp.is_auto_commit(), ec);
-        return connection<Bindings,TP>(std::move(conn_ptr), std::move(tp), this);
+    // Called by a producer on its way out of write
+    void leave()
+    {
+        --writers_;
+        if (stalled_)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            flush_cv_.notify_one();
+        }
     }
 
-    void free_connection(std::unique_ptr<connection_impl>& connection)
+    size_t pop(std::tuple<std::vector<Columns>...>& columns, size_t max_rows)
     {
-        std::lock_guard<std::mutex> lock(connection_pool_mutex_);
-        if (free_connections_.size() >= max_pool_size_)
+        std::apply([](auto&... column) {(column.clear(), ...);}, columns);
+        size_t n = 0;
+        row_type row;
+        while (n < max_rows && queue_.try_pop(row))
         {
-            // Do nothing
+            append(columns, row, std::index_sequence_for<Columns...>());
+            ++n;
         }
-        else
+        if (n > 0)
         {
-            if (connection->is_valid())
+            // A producer that found the queue full waits for this
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (num_blocked_ > 0)
             {
-                free_connections_.push(std::move(connection));
+                std::lock_guard<std::mutex> lock(mutex_);
+                room_cv_.notify_all();
             }
-            else
+        }
+        return n;
+    }
+
+    template <std::size_t... I>
+    static void append(std::tuple<std::vector<Columns>...>& columns, row_type& row, std::index_sequence<I...>)
+    {
+        (std::get<I>(columns).push_back(std::move(std::get<I>(row))), ...);
+    }
+
+    void execute(std::tuple<std::vector<Columns>...>& columns, std::vector<param_status>& status, size_t n)
+    {
+        std::error_code ec;
+        statement_->execute_many(std::apply([](auto&... column) {return std::tie(column...);}, columns), status, ec);
+
+        // After an error, rows not reported as executed were dequeued but not written
+        size_t failed = 0;
+        size_t succeeded = 0;
+        for (auto s : status)
+        {
+            if (s == param_status::error)
+            {
+                ++failed;
+            }
+            else if (s == param_status::success || s == param_status::success_with_info)
             {
-                // Do nothing
+                ++succeeded;
             }
         }
+        if (ec)
+        {
+            failed = n - (std::min)(succeeded, n);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        written_ += n;
+        failed_rows_ += failed;
+        if (ec && !error_)
+        {
+            error_ = ec;
+        }
+        written_cv_.notify_all();
     }
 };
- 
 
 }
 
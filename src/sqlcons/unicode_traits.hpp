@@ -38,6 +38,22 @@
 #include <iterator>
 #include <type_traits>
 #include <system_error>
+#include <cstring>
+#include <cstdint>
+
+#if !defined(UNICONS_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define UNICONS_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UNICONS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define UNICONS_TARGET_AVX2
+#endif
 
 namespace unicons {
 
@@ -853,6 +869,427 @@ convert(InputIt first, InputIt last,
     return convert_result<InputIt>{first,result} ;
 }
 
+// Vectorized transcoding between UTF-8 and UTF-16 or UTF-32 in contiguous buffers.
+// Runs of ASCII are converted 16 or 32 code units at a time, with SSE2 or AVX2 chosen 
+// at run time, and other sequences are validated and converted one code point at a time.
+
+enum class simd_level 
+{
+    scalar, 
+    sse2, 
+    avx2
+};
+
+namespace detail {
+
+inline simd_level detect_simd_level() UNICONS_NOEXCEPT
+{
+#if defined(UNICONS_NO_SIMD) || !defined(UNICONS_X86_64)
+    return simd_level::scalar;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7)
+    {
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (osxsave && avx && (_xgetbv(0) & 6) == 6)
+        {
+            __cpuidex(info, 7, 0);
+            if ((info[1] & (1 << 5)) != 0)
+            {
+                return simd_level::avx2;
+            }
+        }
+    }
+    return simd_level::sse2;
+#else
+    return __builtin_cpu_supports("avx2") ? simd_level::avx2 : simd_level::sse2;
+#endif
+}
+
+// widen_ascii copies the leading ASCII bytes of [p,p+n) to out, and returns how many
+
+template <class CharT>
+size_t widen_ascii_scalar(const uint8_t* p, size_t n, CharT* out) UNICONS_NOEXCEPT
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p + i, 8);
+        if ((word & 0x8080808080808080ull) != 0)
+        {
+            break;
+        }
+        for (size_t k = 0; k < 8; ++k)
+        {
+            out[i+k] = static_cast<CharT>(p[i+k]);
+        }
+    }
+    for (; i < n && p[i] < 0x80; ++i)
+    {
+        out[i] = static_cast<CharT>(p[i]);
+    }
+    return i;
+}
+
+// narrow_ascii copies the leading code units of [p,p+n) that are ASCII to out, and returns how many
+
+template <class CharT>
+size_t narrow_ascii_scalar(const CharT* p, size_t n, uint8_t* out) UNICONS_NOEXCEPT
+{
+    size_t i = 0;
+    for (; i < n && static_cast<uint32_t>(p[i]) < 0x80; ++i)
+    {
+        out[i] = static_cast<uint8_t>(p[i]);
+    }
+    return i;
+}
+
+#if defined(UNICONS_X86_64)
+
+template <class CharT>
+size_t widen_ascii_sse2(const uint8_t* p, size_t n, CharT* out) UNICONS_NOEXCEPT
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        if (_mm_movemask_epi8(v) != 0)
+        {
+            break;
+        }
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        if (sizeof(CharT) == 2)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), lo);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), hi);
+        }
+        else
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+        }
+    }
+    return i + widen_ascii_scalar(p + i, n - i, out + i);
+}
+
+template <class CharT>
+size_t narrow_ascii_sse2(const CharT* p, size_t n, uint8_t* out) UNICONS_NOEXCEPT
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    if (sizeof(CharT) == 2)
+    {
+        const __m128i mask = _mm_set1_epi16(static_cast<short>(0xFF80));
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 8));
+            __m128i high = _mm_and_si128(_mm_or_si128(a, b), mask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF)
+            {
+                break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+        }
+    }
+    else
+    {
+        const __m128i mask = _mm_set1_epi32(static_cast<int>(0xFFFFFF80));
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 4));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 8));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 12));
+            __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), mask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF)
+            {
+                break;
+            }
+            __m128i ab = _mm_packs_epi32(a, b);
+            __m128i cd = _mm_packs_epi32(c, d);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(ab, cd));
+        }
+    }
+    return i + narrow_ascii_scalar(p + i, n - i, out + i);
+}
+
+template <class CharT>
+UNICONS_TARGET_AVX2
+size_t widen_ascii_avx2(const uint8_t* p, size_t n, CharT* out) UNICONS_NOEXCEPT
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        if (_mm256_movemask_epi8(v) != 0)
+        {
+            break;
+        }
+        __m128i lo = _mm256_castsi256_si128(v);
+        __m128i hi = _mm256_extracti128_si256(v, 1);
+        if (sizeof(CharT) == 2)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(lo));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi16(hi));
+        }
+        else
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi32(lo));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi32(hi));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+        }
+    }
+    return i + widen_ascii_sse2(p + i, n - i, out + i);
+}
+
+template <class CharT>
+UNICONS_TARGET_AVX2
+size_t narrow_ascii_avx2(const CharT* p, size_t n, uint8_t* out) UNICONS_NOEXCEPT
+{
+    size_t i = 0;
+    if (sizeof(CharT) == 2)
+    {
+        const __m256i mask = _mm256_set1_epi16(static_cast<short>(0xFF80));
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 16));
+            if (!_mm256_testz_si256(_mm256_or_si256(a, b), mask))
+            {
+                break;
+            }
+            // packus works within 128 bit lanes, the permute restores the order
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+        }
+    }
+    return i + narrow_ascii_sse2(p + i, n - i, out + i);
+}
+
+#endif
+
+inline simd_level current_simd_level() UNICONS_NOEXCEPT
+{
+    static const simd_level level = detect_simd_level();
+    return level;
+}
+
+template <class CharT>
+size_t widen_ascii(const uint8_t* p, size_t n, CharT* out) UNICONS_NOEXCEPT
+{
+#if defined(UNICONS_X86_64)
+    switch (current_simd_level())
+    {
+    case simd_level::avx2:
+        return widen_ascii_avx2(p, n, out);
+    case simd_level::sse2:
+        return widen_ascii_sse2(p, n, out);
+    default:
+        break;
+    }
+#endif
+    return widen_ascii_scalar(p, n, out);
+}
+
+template <class CharT>
+size_t narrow_ascii(const CharT* p, size_t n, uint8_t* out) UNICONS_NOEXCEPT
+{
+#if defined(UNICONS_X86_64)
+    switch (current_simd_level())
+    {
+    case simd_level::avx2:
+        return narrow_ascii_avx2(p, n, out);
+    case simd_level::sse2:
+        return narrow_ascii_sse2(p, n, out);
+    default:
+        break;
+    }
+#endif
+    return narrow_ascii_scalar(p, n, out);
+}
+
+}
+
+// The instruction set used by the vectorized transcoders on this machine
+inline simd_level active_simd_level() UNICONS_NOEXCEPT
+{
+    return detail::current_simd_level();
+}
+
+template <class InputCharT, class OutputCharT>
+struct transcode_result
+{
+    const InputCharT* it;
+    OutputCharT* target;
+    conv_errc ec;
+};
+
+// Converts UTF-8 to UTF-16 or UTF-32. target must have room for last - first code units.
+template <class CharT>
+typename std::enable_if<std::is_integral<CharT>::value && (sizeof(CharT) == sizeof(uint16_t) || sizeof(CharT) == sizeof(uint32_t)),
+                        transcode_result<char,CharT>>::type
+transcode(const char* first, const char* last, CharT* target, conv_flags flags = conv_flags::strict) UNICONS_NOEXCEPT
+{
+    (void)flags;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(first);
+    const uint8_t* end = reinterpret_cast<const uint8_t*>(last);
+    while (p != end)
+    {
+        size_t n = detail::widen_ascii(p, static_cast<size_t>(end - p), target);
+        p += n;
+        target += n;
+        if (p == end)
+        {
+            break;
+        }
+
+        size_t length = trailing_bytes_for_utf8[*p] + 1;
+        if (length > static_cast<size_t>(end - p))
+        {
+            return transcode_result<char,CharT>{reinterpret_cast<const char*>(p), target, conv_errc::source_exhausted};
+        }
+        conv_errc result = is_legal_utf8(p, length);
+        if (result != conv_errc())
+        {
+            return transcode_result<char,CharT>{reinterpret_cast<const char*>(p), target, result};
+        }
+        uint32_t ch = 0;
+        for (size_t k = 0; k < length; ++k)
+        {
+            ch = (ch << 6) + p[k];
+        }
+        ch -= offsets_from_utf8[length-1];
+        p += length;
+
+        // is_legal_utf8 rules out surrogates and values above max_legal_utf32
+        if (sizeof(CharT) == sizeof(uint16_t) && ch > max_bmp)
+        {
+            ch -= half_base;
+            *target++ = static_cast<CharT>((ch >> half_shift) + sur_high_start);
+            *target++ = static_cast<CharT>((ch & half_mask) + sur_low_start);
+        }
+        else
+        {
+            *target++ = static_cast<CharT>(ch);
+        }
+    }
+    return transcode_result<char,CharT>{reinterpret_cast<const char*>(p), target, conv_errc()};
+}
+
+// Converts UTF-16 or UTF-32 to UTF-8. target must have room for 3 (UTF-16) or 4 (UTF-32) 
+// bytes per code unit.
+template <class CharT>
+typename std::enable_if<std::is_integral<CharT>::value && (sizeof(CharT) == sizeof(uint16_t) || sizeof(CharT) == sizeof(uint32_t)),
+                        transcode_result<CharT,char>>::type
+transcode(const CharT* first, const CharT* last, char* target, conv_flags flags = conv_flags::strict) UNICONS_NOEXCEPT
+{
+    const CharT* p = first;
+    uint8_t* out = reinterpret_cast<uint8_t*>(target);
+    while (p != last)
+    {
+        size_t n = detail::narrow_ascii(p, static_cast<size_t>(last - p), out);
+        p += n;
+        out += n;
+        if (p == last)
+        {
+            break;
+        }
+
+        const CharT* start = p;
+        uint32_t ch = static_cast<uint32_t>(*p++);
+        if (sizeof(CharT) == sizeof(uint16_t))
+        {
+            if (is_high_surrogate(ch))
+            {
+                if (p == last)
+                {
+                    return transcode_result<CharT,char>{start, reinterpret_cast<char*>(out), conv_errc::source_exhausted};
+                }
+                uint32_t ch2 = static_cast<uint32_t>(*p);
+                if (is_low_surrogate(ch2))
+                {
+                    ch = ((ch - sur_high_start) << half_shift) + (ch2 - sur_low_start) + half_base;
+                    ++p;
+                }
+                else if (flags == conv_flags::strict)
+                {
+                    return transcode_result<CharT,char>{start, reinterpret_cast<char*>(out), conv_errc::unpaired_high_surrogate};
+                }
+                else
+                {
+                    ch = replacement_char;
+                }
+            }
+            else if (is_low_surrogate(ch))
+            {
+                if (flags == conv_flags::strict)
+                {
+                    return transcode_result<CharT,char>{start, reinterpret_cast<char*>(out), conv_errc::source_illegal};
+                }
+                ch = replacement_char;
+            }
+        }
+        else if (is_surrogate(ch) || ch > max_legal_utf32)
+        {
+            if (flags == conv_flags::strict)
+            {
+                return transcode_result<CharT,char>{start, reinterpret_cast<char*>(out), 
+                                                    is_surrogate(ch) ? conv_errc::illegal_surrogate_value : conv_errc::source_illegal};
+            }
+            ch = replacement_char;
+        }
+
+        if (ch < 0x800)
+        {
+            *out++ = static_cast<uint8_t>(0xC0 | (ch >> 6));
+            *out++ = static_cast<uint8_t>(0x80 | (ch & 0x3F));
+        }
+        else if (ch < 0x10000)
+        {
+            *out++ = static_cast<uint8_t>(0xE0 | (ch >> 12));
+            *out++ = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3F));
+            *out++ = static_cast<uint8_t>(0x80 | (ch & 0x3F));
+        }
+        else
+        {
+            *out++ = static_cast<uint8_t>(0xF0 | (ch >> 18));
+            *out++ = static_cast<uint8_t>(0x80 | ((ch >> 12) & 0x3F));
+            *out++ = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3F));
+            *out++ = static_cast<uint8_t>(0x80 | (ch & 0x3F));
+        }
+    }
+    return transcode_result<CharT,char>{p, reinterpret_cast<char*>(out), conv_errc()};
+}
+
+// Appends the transcoding of [first,last) to a contiguous container of code units, 
+// such as std::string, std::wstring or std::vector<char16_t>
+template <class InputCharT, class Container>
+conv_errc transcode_append(const InputCharT* first, const InputCharT* last, Container& target, 
+                           conv_flags flags = conv_flags::strict)
+{
+    typedef typename Container::value_type output_type;
+    static_assert(sizeof(InputCharT) == sizeof(char) || sizeof(output_type) == sizeof(char), 
+                  "One side of the transcoding must be UTF-8");
+
+    size_t size = target.size();
+    size_t length = static_cast<size_t>(last - first);
+    size_t bound = sizeof(InputCharT) == sizeof(char) ? length : length*(sizeof(InputCharT) == sizeof(uint16_t) ? 3 : 4);
+    target.resize(size + bound);
+    auto result = transcode(first, last, &target[0] + size, flags);
+    target.resize(static_cast<size_t>(result.target - &target[0]));
+    return result.ec;
+}
+
 // validate
 
 template <class InputIt>
@@ -1,18 +1,23 @@
 #include <sqlcons_bindings/odbc/odbc_bindings.hpp>
+#if defined(_WIN32)
 #include <windows.h> 
-#ifndef UNICODE  
-#define UNICODE  
 #endif
 #include <string> 
+#include <sql.h> 
 #include <sqlext.h> 
 #include <stdio.h> 
-#include <conio.h> 
-#include <tchar.h> 
 #include <stdlib.h> 
 #include <iostream>
 #include <sqlcons/unicode_traits.hpp>
 #include <vector>
 #include <sstream>
+#include <charconv>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <algorithm>
+#include <limits>
 
 namespace sqlcons { 
 
@@ -51,8 +56,71 @@ int sql_type_traits<odbc::odbc_bindings,double>::sql_type_identifier() { return
 template<>
 int sql_type_traits<odbc::odbc_bindings,double>::c_type_identifier() { return SQL_C_DOUBLE; }
 
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,bool>::sql_type_identifier() { return SQL_CHAR; }
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,bool>::c_type_identifier() { return SQL_C_CHAR; }
+
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,std::string>::sql_type_identifier() { return SQL_VARCHAR; }
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,std::string>::c_type_identifier() { return SQL_C_CHAR; }
+
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,int16_t>::sql_type_identifier() { return SQL_SMALLINT; }
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,int16_t>::c_type_identifier() { return SQL_C_SSHORT; }
+
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,int32_t>::sql_type_identifier() { return SQL_INTEGER; }
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,int32_t>::c_type_identifier() { return SQL_C_SLONG; }
+
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,int64_t>::sql_type_identifier() { return SQL_BIGINT; }
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,int64_t>::c_type_identifier() { return SQL_C_SBIGINT; }
+
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,uint64_t>::sql_type_identifier() { return SQL_BIGINT; }
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,uint64_t>::c_type_identifier() { return SQL_C_UBIGINT; }
+
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,double>::sql_type_identifier() { return SQL_DOUBLE; }
+template<>
+int sql_type_traits<odbc::odbc_utf8_bindings,double>::c_type_identifier() { return SQL_C_DOUBLE; }
+
 namespace odbc {
 
+// Wide text is held as char16_t, which has the layout of SQLWCHAR on Windows and unixODBC
+
+static_assert(sizeof(SQLWCHAR) == sizeof(char16_t), "SQLWCHAR must be a UTF-16 code unit");
+
+inline SQLWCHAR* sql_wchar(std::u16string& s)
+{
+    return reinterpret_cast<SQLWCHAR*>(&s[0]);
+}
+
+inline SQLCHAR* sql_char(const std::string& s)
+{
+    return (SQLCHAR*)s.data();
+}
+
+std::wstring to_wstring(const char16_t* first, const char16_t* last)
+{
+    std::wstring s;
+    if (sizeof(wchar_t) == sizeof(char16_t))
+    {
+        s.assign(first, last);
+    }
+    else
+    {
+        unicons::convert(first, last, std::back_inserter(s), unicons::conv_flags::lenient);
+    }
+    return s;
+}
+
 // odbc_error_category_impl
 
 const std::error_category& odbc_error_category()
@@ -66,6 +134,11 @@ std::error_code make_error_code(odbc_errc result)
     return std::error_code(static_cast<int>(result), odbc_error_category());
 }
 
+bool is_transient_error(const std::error_code& ec)
+{
+    return ec == make_error_code(odbc_errc::E_40001) || ec == make_error_code(odbc_errc::E_HYT01);
+}
+
 std::string odbc_error_category_impl::message(int ev) const
 {
     switch (static_cast<odbc_errc>(ev))
@@ -164,21 +237,82 @@ std::string odbc_error_category_impl::message(int ev) const
         return "[IM018] SQLCompleteAsync has not been called to complete the previous asynchronous operation on this handle. If the previous function call on the handle returns SQL_STILL_EXECUTING and if notification mode is enabled, SQLCompleteAsync must be called on the handle to do post-processing and complete the operation";
     case odbc_errc::E_42S22:
         return "[E_42S22] Column not found";
+    case odbc_errc::E_HY003:
+        return "[HY003] Invalid application buffer type";
     default:
         return "db error";
     }
 }
 
+// odbc_environment
+
+// An environment handle shared by the connections opened while it is alive
+
+class odbc_environment
+{
+    SQLHENV henv_;
+public:
+    odbc_environment(SQLHENV henv)
+        : henv_(henv)
+    {
+    }
+
+    odbc_environment(const odbc_environment&) = delete;
+
+    ~odbc_environment()
+    {
+        SQLFreeHandle(SQL_HANDLE_ENV, henv_);
+    }
+
+    SQLHENV handle() const
+    {
+        return henv_;
+    }
+
+    static std::shared_ptr<odbc_environment> shared(std::error_code& ec);
+};
+
+static std::mutex environment_mutex;
+static std::weak_ptr<odbc_environment> shared_environment;
+static bool pooling_enabled = false;
+// Keeps the environment, and the connections pooled in it, while pooling is on
+static std::shared_ptr<odbc_environment> pooling_environment;
+
 // odbc_connection_impl
 
+// Statement handles kept by a connection for execute, more are allocated
+// when execute is called from a result callback
+const size_t max_free_statements = 4;
+
+// SQL_TXN_SS_SNAPSHOT, from the SQL Server driver headers
+const SQLUINTEGER sql_txn_ss_snapshot = 0x00000020L;
+
+// A connection attribute as last set, and as it was before first changed
+
+struct session_attribute
+{
+    SQLINTEGER attribute;
+    std::optional<SQLUINTEGER> current; // unknown until read or set
+    std::optional<SQLUINTEGER> original;
+};
+
 class odbc_connection_impl : public virtual connection_impl
 {
-    bool autoCommit_;
+    bool autoCommit_; // as set on the connection
+    size_t row_array_size_;
+    bool utf8_; // text is exchanged with the driver as UTF-8 (SQL_C_CHAR)
+    std::vector<SQLHSTMT> free_statements_;
+    std::u16string query_buffer_; // UTF-16 query text, reused
+    session_attribute timeout_;
+    session_attribute isolation_;
+    session_attribute access_mode_;
+    std::optional<std::string> catalog_;
+    std::optional<std::string> original_catalog_;
 public:
-    SQLHENV     henv_;
+    std::shared_ptr<odbc_environment> env_; // outlives hdbc_
     SQLHDBC     hdbc_; 
 
-    odbc_connection_impl();
+    odbc_connection_impl(bool utf8 = false);
 
     ~odbc_connection_impl();
 
@@ -188,6 +322,16 @@ public:
 
     void connection_timeout(size_t val, std::error_code& ec) override;
 
+    void isolation_level(sqlcons::isolation_level val, std::error_code& ec) override;
+
+    void read_only(bool val, std::error_code& ec) override;
+
+    void catalog(const std::string& val, std::error_code& ec) override;
+
+    void reset_session(std::error_code& ec) override;
+
+    void row_array_size(size_t val) override;
+
     std::unique_ptr<prepared_statement_impl> prepare_statement(const std::string& query, std::error_code& ec) override;
 
     void commit(std::error_code& ec) override;
@@ -197,8 +341,67 @@ public:
     void execute(const std::string& query, 
                  const std::function<void(const row& rec)>& callback,
                  std::error_code& ec) override;
+    void execute_batches(const std::string& query, 
+                         size_t batch_size,
+                         const std::function<void(const record_batch& batch)>& callback,
+                         std::error_code& ec) override;
 
     bool is_valid() const override;
+
+    // A statement handle for executing a query directly, reused from an earlier execute if possible
+    SQLHSTMT acquire_statement(std::error_code& ec);
+
+    // Closes the cursor and resets the parameters of hstmt, and keeps it for the next execute
+    void release_statement(SQLHSTMT hstmt);
+
+    std::u16string& query_buffer()
+    {
+        return query_buffer_;
+    }
+private:
+    void set_attribute(session_attribute& attr, SQLUINTEGER val, std::error_code& ec);
+
+    void restore_attribute(session_attribute& attr, std::error_code& ec);
+
+    void get_catalog(std::string& val, std::error_code& ec);
+
+    void set_catalog(const std::string& val, std::error_code& ec);
+};
+
+class rowset;
+
+// bound_parameter
+
+struct bound_parameter
+{
+    SQLSMALLINT c_type_identifier;
+    SQLSMALLINT sql_type_identifier;
+    SQLPOINTER buffer;
+    SQLULEN column_size;
+    SQLLEN buffer_length;
+    SQLLEN ind;
+    bool bound;
+    size_t bound_capacity; // characters the text buffer is bound for, excluding the terminator
+    alignas(8) unsigned char value[16];
+    std::u16string text;
+    std::string bytes; // UTF-8 text bound as SQL_C_CHAR
+
+    bound_parameter()
+        : c_type_identifier(0), sql_type_identifier(0), buffer(nullptr), 
+          column_size(0), buffer_length(0), ind(0), bound(false), bound_capacity(0)
+    {
+    }
+
+    // Grows the bound text capacity geometrically, so that a parameter whose
+    // values keep getting longer is rebound a logarithmic number of times
+    size_t grow_capacity(size_t length)
+    {
+        if (length > bound_capacity)
+        {
+            bound_capacity = (std::max)(length, 2*bound_capacity);
+        }
+        return bound_capacity;
+    }
 };
 
 // odbc_prepared_statement_impl
@@ -206,30 +409,89 @@ public:
 class odbc_prepared_statement_impl : public virtual prepared_statement_impl
 {
     SQLHSTMT hstmt_; 
+    size_t row_array_size_;
+    size_t initial_row_array_size_; // restored by reset_
+    bool utf8_;
+    // Described and bound result columns, reused across executions
+    std::unique_ptr<rowset> rowset_;
+    size_t rowset_size_;
+    // Columns bound to caller storage by bind_columns_
+    std::vector<column_binding> bound_columns_;
+    std::vector<SQLLEN> indicators_;
+    std::u16string buffer_;
+    std::string bytes_;
+    // Result column names, described once for name lookup
+    column_index columns_;
+    bool columns_described_;
+    // Parameters bound to statement owned buffers, kept bound across executions
+    std::vector<bound_parameter> bound_params_;
+    // Indicator and status arrays for execute_array_
+    std::vector<std::vector<SQLLEN>> param_lengths_;
+    std::vector<SQLUSMALLINT> param_status_;
 public:
     odbc_prepared_statement_impl();
 
-    odbc_prepared_statement_impl(SQLHSTMT hstmt);
+    odbc_prepared_statement_impl(SQLHSTMT hstmt, size_t row_array_size, bool utf8);
 
     odbc_prepared_statement_impl(const odbc_prepared_statement_impl&) = delete;
 
     odbc_prepared_statement_impl(odbc_prepared_statement_impl&&) = default;
 
-    ~odbc_prepared_statement_impl()
+    ~odbc_prepared_statement_impl();
+
+    void row_array_size(size_t val) override
     {
-        if (hstmt_) 
-        { 
-            SQLFreeHandle(SQL_HANDLE_STMT, hstmt_); 
-        } 
+        row_array_size_ = val;
     }
 
-    void execute_(std::vector<std::unique_ptr<parameter_base>>& bindings, 
+    void execute_(const parameter_binding* params, size_t count,
                   const std::function<void(const row& rec)>& callback,
                   std::error_code& ec) override;
 
-    void execute_(std::vector<std::unique_ptr<parameter_base>>& bindings, 
+    void execute_(const parameter_binding* params, size_t count,
                   std::error_code& ec) override;
 
+    void execute_batches_(const parameter_binding* params, size_t count,
+                          size_t batch_size,
+                          const std::function<void(const record_batch& batch)>& callback,
+                          std::error_code& ec) override;
+
+    void execute_array_(std::vector<std::unique_ptr<parameter_array_base>>& columns, 
+                        size_t count,
+                        param_status* status,
+                        std::error_code& ec) override;
+
+    void bind_columns_(const column_binding* columns, size_t count, std::error_code& ec) override;
+
+    bool fetch_(std::error_code& ec) override;
+
+    void get_data_(size_t column, int c_type_identifier, void* buffer, size_t buffer_length, std::error_code& ec) override;
+
+    void get_string_(size_t column, std::string& s, std::error_code& ec) override;
+
+    void close_cursor_() override;
+
+    void reset_() override;
+
+    void refresh_columns_() override;
+
+    void describe_(statement_metadata& metadata, std::error_code& ec) override;
+
+    size_t column_index_(std::string_view name, std::error_code& ec) override;
+private:
+    void execute_statement(const parameter_binding* params, size_t count, 
+                           std::error_code& ec);
+
+    void fetch_results(const std::function<void(const row& rec)>& callback,
+                       std::error_code& ec);
+
+    void unbind_parameters();
+
+    void get_bytes(size_t column, std::string& s, std::error_code& ec);
+
+    rowset* result_rowset(size_t row_array_size, std::error_code& ec);
+
+    void reset_rowset();
 };
 
 // odbc_bindings
@@ -241,42 +503,81 @@ std::unique_ptr<connection_impl> odbc_bindings::create_connection(const std::str
     return std::move(ptr);
 }
 
+// odbc_utf8_bindings
+
+std::unique_ptr<connection_impl> odbc_utf8_bindings::create_connection(const std::string& connString, std::error_code& ec)
+{
+    auto ptr = std::make_unique<odbc_connection_impl>(true);
+    ptr->open(connString, ec);
+    return ptr;
+}
+
 void process_results(SQLHSTMT hstmt,
+                     size_t row_array_size,
+                     bool utf8,
                      const std::function<void(const row& rec)>& callback,
                      std::error_code& ec);
 
+void process_batches(SQLHSTMT hstmt,
+                     size_t batch_size,
+                     bool utf8,
+                     const std::function<void(const record_batch& batch)>& callback,
+                     std::error_code& ec);
+
 void handle_diagnostic_record(SQLHANDLE hHandle,
                               SQLSMALLINT hType,
                               RETCODE RetCode,
                               std::error_code& ec);
 
 
+// Query text is passed as UTF-16, or as is to the ANSI entry points in UTF-8 mode
+
+// buf is a conversion buffer, reused across calls
+
+RETCODE prepare_query(SQLHSTMT hstmt, const std::string& query, bool utf8, std::u16string& buf)
+{
+    if (utf8)
+    {
+        return SQLPrepare(hstmt, sql_char(query), (SQLINTEGER)query.size());
+    }
+    buf.clear();
+    unicons::transcode_append(query.data(), query.data() + query.size(), buf);
+    return SQLPrepareW(hstmt, sql_wchar(buf), (SQLINTEGER)buf.size());
+}
+
+RETCODE execute_query(SQLHSTMT hstmt, const std::string& query, bool utf8, std::u16string& buf)
+{
+    if (utf8)
+    {
+        return SQLExecDirect(hstmt, sql_char(query), (SQLINTEGER)query.size());
+    }
+    buf.clear();
+    unicons::transcode_append(query.data(), query.data() + query.size(), buf);
+    return SQLExecDirectW(hstmt, sql_wchar(buf), (SQLINTEGER)buf.size());
+}
+
 // statement_impl
 
+// Executes a query directly on a statement handle borrowed from the connection
+
 class statement_impl
 {
+    odbc_connection_impl& conn_;
     SQLHSTMT hstmt_; 
+    bool utf8_;
 public:
-    statement_impl(SQLHDBC hDbc, std::error_code& ec)
-        : hstmt_(nullptr)
+    statement_impl(odbc_connection_impl& conn, bool utf8, std::error_code& ec)
+        : conn_(conn), hstmt_(conn.acquire_statement(ec)), utf8_(utf8)
     {
-        RETCODE rc = SQLAllocHandle(SQL_HANDLE_STMT, hDbc, &hstmt_);
-        if (rc == SQL_ERROR)
-        {
-            handle_diagnostic_record(hDbc, SQL_HANDLE_DBC, rc, ec);
-            return;
-        }
     }
 
     statement_impl(const statement_impl&) = delete;
 
-    statement_impl(statement_impl&&) = default;
-
     ~statement_impl()
     {
         if (hstmt_) 
         { 
-            SQLFreeHandle(SQL_HANDLE_STMT, hstmt_); 
+            conn_.release_statement(hstmt_); 
         } 
     }
 
@@ -284,180 +585,437 @@ public:
                  std::error_code& ec);
 
     void execute(const std::string& query, 
+                 size_t row_array_size,
                  const std::function<void(const row& rec)>& callback,
                  std::error_code& ec);
+
+    void execute_batches(const std::string& query, 
+                         size_t batch_size,
+                         const std::function<void(const record_batch& batch)>& callback,
+                         std::error_code& ec);
 };
 
+// odbc_environment
+
+void driver_manager_pooling(bool on, std::error_code& ec)
+{
+    std::lock_guard<std::mutex> lock(environment_mutex);
+    // A process level attribute, applies to environments allocated after it is set
+    RETCODE rc = SQLSetEnvAttr(SQL_NULL_HANDLE, 
+                               SQL_ATTR_CONNECTION_POOLING, 
+                               on ? (SQLPOINTER)SQL_CP_ONE_PER_HENV : (SQLPOINTER)SQL_CP_OFF, 
+                               SQL_IS_UINTEGER);
+    if (rc == SQL_ERROR)
+    {
+        ec = make_error_code(odbc_errc::db_err);
+        return;
+    }
+    pooling_enabled = on;
+    if (!on)
+    {
+        pooling_environment.reset();
+    }
+}
+
+std::shared_ptr<odbc_environment> odbc_environment::shared(std::error_code& ec)
+{
+    std::lock_guard<std::mutex> lock(environment_mutex);
+    auto env = shared_environment.lock();
+    if (env)
+    {
+        return env;
+    }
+
+    SQLHENV henv;
+    RETCODE rc = SQLAllocHandle(SQL_HANDLE_ENV, 
+                        SQL_NULL_HANDLE, 
+                        &henv);
+    if (rc == SQL_ERROR)
+    {
+        ec = make_error_code(odbc_errc::db_err);
+        return nullptr;
+    }
+    env = std::make_shared<odbc_environment>(henv);
+
+    // Register this as an application that expects 3.x behavior, 
+    // you must register something if you use AllocHandle 
+
+    rc = SQLSetEnvAttr(henv, 
+                       SQL_ATTR_ODBC_VERSION, 
+                       (SQLPOINTER)SQL_OV_ODBC3, 
+                       0);
+    if (rc != SQL_SUCCESS)
+    {
+        handle_diagnostic_record(henv, SQL_HANDLE_ENV, rc, ec);
+        return nullptr;
+    }
+
+    shared_environment = env;
+    if (pooling_enabled)
+    {
+        pooling_environment = env;
+    }
+    return env;
+}
+
 // odbc_connection_impl
 
-odbc_connection_impl::odbc_connection_impl()
-    : henv_(nullptr), hdbc_(nullptr), autoCommit_(false)
+odbc_connection_impl::odbc_connection_impl(bool utf8)
+    : autoCommit_(false), row_array_size_(default_row_array_size), utf8_(utf8), 
+      timeout_{SQL_ATTR_CONNECTION_TIMEOUT, {}, {}}, isolation_{SQL_ATTR_TXN_ISOLATION, {}, {}}, 
+      access_mode_{SQL_ATTR_ACCESS_MODE, {}, {}}, 
+      hdbc_(nullptr)
 {
 }
 
 odbc_connection_impl::~odbc_connection_impl()
 {
+    // Statement handles are freed before the connection
+    statements().clear();
+    for (SQLHSTMT hstmt : free_statements_)
+    {
+        SQLFreeHandle(SQL_HANDLE_STMT, hstmt);
+    }
+
     if (hdbc_) 
     { 
         SQLDisconnect(hdbc_); 
         SQLFreeHandle(SQL_HANDLE_DBC, hdbc_); 
     } 
-
-    if (henv_) 
-    { 
-        SQLFreeHandle(SQL_HANDLE_ENV, henv_); 
-    } 
 }
 
 void odbc_connection_impl::auto_commit(bool val, std::error_code& ec)
 {
-    autoCommit_ = val;
+    if (val == autoCommit_)
+    {
+        return;
+    }
 
     RETCODE rc;
     if (val)
     {
         rc = SQLSetConnectAttr(hdbc_, 
                            SQL_ATTR_AUTOCOMMIT, 
-                           (SQLPOINTER)TRUE, 
+                           (SQLPOINTER)SQL_AUTOCOMMIT_ON, 
                            0);
     }
     else
     {
         rc = SQLSetConnectAttr(hdbc_, 
                            SQL_ATTR_AUTOCOMMIT, 
-                           (SQLPOINTER)FALSE, 
+                           (SQLPOINTER)SQL_AUTOCOMMIT_OFF, 
                            0);
     }
     if (rc != SQL_SUCCESS)
     {
-        handle_diagnostic_record(henv_, SQL_HANDLE_ENV, rc, ec);
+        handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+        return;
     }
+    autoCommit_ = val;
 }
 
 void odbc_connection_impl::connection_timeout(size_t val, std::error_code& ec)
 {
-    RETCODE rc;
-
-    rc = SQLSetConnectAttr(hdbc_, 
-                       SQL_ATTR_CONNECTION_TIMEOUT, 
-                       (SQLPOINTER)val, 
-                       0);
-    if (rc != SQL_SUCCESS)
-    {
-        handle_diagnostic_record(henv_, SQL_HANDLE_ENV, rc, ec);
-    }
+    set_attribute(timeout_, (SQLUINTEGER)val, ec);
 }
 
-void odbc_connection_impl::execute(const std::string& query, 
-                                   const std::function<void(const row& rec)>& callback,
-                                   std::error_code& ec)
+void odbc_connection_impl::isolation_level(sqlcons::isolation_level val, std::error_code& ec)
 {
-    statement_impl q(hdbc_, ec);
-    if (ec)
+    SQLUINTEGER level = SQL_TXN_READ_COMMITTED;
+    switch (val)
     {
-        return;
+        case sqlcons::isolation_level::read_uncommitted:
+            level = SQL_TXN_READ_UNCOMMITTED;
+            break;
+        case sqlcons::isolation_level::read_committed:
+            level = SQL_TXN_READ_COMMITTED;
+            break;
+        case sqlcons::isolation_level::repeatable_read:
+            level = SQL_TXN_REPEATABLE_READ;
+            break;
+        case sqlcons::isolation_level::serializable:
+            level = SQL_TXN_SERIALIZABLE;
+            break;
+        case sqlcons::isolation_level::snapshot:
+            level = sql_txn_ss_snapshot;
+            break;
     }
-    q.execute(query,callback,ec);
+    set_attribute(isolation_, level, ec);
 }
 
-bool odbc_connection_impl::is_valid() const
+void odbc_connection_impl::read_only(bool val, std::error_code& ec)
 {
-    SQLUINTEGER	valid = SQL_CD_FALSE;
-    RETCODE rc = SQLGetConnectAttr(hdbc_, 
-                                   //SQL_COPT_SS_CONNECTION_DEAD,
-                                  SQL_ATTR_CONNECTION_DEAD,
-                                  (SQLPOINTER) &valid,
-                                  (SQLINTEGER) sizeof(valid),
-                                  NULL);
-    return rc == SQL_SUCCESS && valid == SQL_CD_TRUE;
+    set_attribute(access_mode_, val ? SQL_MODE_READ_ONLY : SQL_MODE_READ_WRITE, ec);
 }
 
-void odbc_connection_impl::execute(const std::string& query, 
-                               std::error_code& ec)
+void odbc_connection_impl::catalog(const std::string& val, std::error_code& ec)
 {
-    statement_impl q(hdbc_, ec);
-    if (ec)
+    if (catalog_ == val)
     {
         return;
     }
-    q.execute(query,ec);
+    if (!original_catalog_)
+    {
+        std::string original;
+        get_catalog(original, ec);
+        if (ec)
+        {
+            return;
+        }
+        original_catalog_ = original;
+        catalog_ = original;
+        if (original == val)
+        {
+            return;
+        }
+    }
+    set_catalog(val, ec);
 }
 
-void odbc_connection_impl::open(const std::string& connString, std::error_code& ec)
+void odbc_connection_impl::reset_session(std::error_code& ec)
 {
-    autoCommit_ = true;
-
-    RETCODE rc = SQLAllocHandle(SQL_HANDLE_ENV, 
-                                SQL_NULL_HANDLE, 
-                                &henv_);
-    if (rc == SQL_ERROR)
+    restore_attribute(timeout_, ec);
+    if (!ec)
     {
-        ec = make_error_code(odbc_errc::db_err);
-        return;
+        restore_attribute(isolation_, ec);
     }
-
-    // Register this as an application that expects 3.x behavior, 
-    // you must register something if you use AllocHandle 
-
-    rc = SQLSetEnvAttr(henv_, 
-                       SQL_ATTR_ODBC_VERSION, 
-                       (SQLPOINTER)SQL_OV_ODBC3, 
-                       0);
-    if (rc != SQL_SUCCESS)
+    if (!ec)
     {
-        handle_diagnostic_record(henv_, SQL_HANDLE_ENV, rc, ec);
-        return;
+        restore_attribute(access_mode_, ec);
     }
-
-    rc = SQLAllocHandle(SQL_HANDLE_DBC, henv_, &hdbc_);
-    if (rc != SQL_SUCCESS)
+    if (!ec && original_catalog_ && catalog_ != original_catalog_)
     {
-        handle_diagnostic_record (henv_, SQL_HANDLE_ENV, rc, ec);
-        return;
+        set_catalog(*original_catalog_, ec);
     }
+}
 
-    std::wstring cs;
-    auto result1 = unicons::convert(connString.begin(),connString.end(),
-                                    std::back_inserter(cs), 
-                                    unicons::conv_flags::strict);
-    //std::cout << connString << std::endl;
-    //std::wcout << cs << std::endl;
-
-    rc = SQLSetConnectAttr(hdbc_, 
-                       SQL_ATTR_AUTOCOMMIT, 
-                       (SQLPOINTER)TRUE, 
-                       0);
+// The value before the first change is read from the driver, so that it can be restored
 
-    if (rc != SQL_SUCCESS)
+void odbc_connection_impl::set_attribute(session_attribute& attr, SQLUINTEGER val, std::error_code& ec)
+{
+    if (attr.current == val)
     {
-        handle_diagnostic_record(henv_, SQL_HANDLE_ENV, rc, ec);
         return;
     }
 
-    // Connect to the driver.  Use the connection string if supplied 
-    // on the input, otherwise let the driver manager prompt for input. 
-    rc = SQLDriverConnect(hdbc_, 
-                         NULL, 
-                         &cs[0], 
-                         (SQLSMALLINT)cs.size(), 
-                         NULL, 
-                         0, 
-                         NULL,
-                         SQL_DRIVER_NOPROMPT);
-    if (rc == SQL_ERROR)
+    RETCODE rc;
+    if (!attr.original)
     {
-        handle_diagnostic_record (hdbc_, SQL_HANDLE_DBC, rc, ec);
-        return;
+        SQLUINTEGER original = 0;
+        rc = SQLGetConnectAttr(hdbc_, attr.attribute, &original, 0, nullptr);
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+            return;
+        }
+        attr.original = original;
+        attr.current = original;
+        if (original == val)
+        {
+            return;
+        }
     }
-}
 
-std::unique_ptr<prepared_statement_impl> odbc_connection_impl::prepare_statement(const std::string& query, std::error_code& ec)
+    rc = SQLSetConnectAttr(hdbc_, attr.attribute, (SQLPOINTER)(SQLULEN)val, 0);
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+        attr.current.reset();
+        return;
+    }
+    attr.current = val;
+}
+
+void odbc_connection_impl::restore_attribute(session_attribute& attr, std::error_code& ec)
+{
+    if (attr.original && attr.current != attr.original)
+    {
+        set_attribute(attr, *attr.original, ec);
+    }
+}
+
+void odbc_connection_impl::get_catalog(std::string& val, std::error_code& ec)
+{
+    RETCODE rc;
+    SQLINTEGER length = 0;
+    if (utf8_)
+    {
+        std::vector<SQLCHAR> buf(256);
+        rc = SQLGetConnectAttr(hdbc_, SQL_ATTR_CURRENT_CATALOG, buf.data(), (SQLINTEGER)buf.size(), &length);
+        if (rc == SQL_SUCCESS_WITH_INFO && (size_t)length >= buf.size())
+        {
+            buf.resize((size_t)length + 1);
+            rc = SQLGetConnectAttr(hdbc_, SQL_ATTR_CURRENT_CATALOG, buf.data(), (SQLINTEGER)buf.size(), &length);
+        }
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+            return;
+        }
+        val.assign((const char*)buf.data(), (std::min)((size_t)length, buf.size() - 1));
+    }
+    else
+    {
+        // Lengths are in bytes
+        std::u16string buf(256, 0);
+        rc = SQLGetConnectAttrW(hdbc_, SQL_ATTR_CURRENT_CATALOG, sql_wchar(buf), 
+                                (SQLINTEGER)(buf.size()*sizeof(char16_t)), &length);
+        if (rc == SQL_SUCCESS_WITH_INFO && (size_t)length/sizeof(char16_t) >= buf.size())
+        {
+            buf.resize((size_t)length/sizeof(char16_t) + 1);
+            rc = SQLGetConnectAttrW(hdbc_, SQL_ATTR_CURRENT_CATALOG, sql_wchar(buf), 
+                                    (SQLINTEGER)(buf.size()*sizeof(char16_t)), &length);
+        }
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+            return;
+        }
+        size_t len = (std::min)((size_t)length/sizeof(char16_t), buf.size() - 1);
+        val.clear();
+        unicons::transcode_append(buf.data(), buf.data() + len, val);
+    }
+}
+
+void odbc_connection_impl::set_catalog(const std::string& val, std::error_code& ec)
+{
+    RETCODE rc;
+    if (utf8_)
+    {
+        rc = SQLSetConnectAttr(hdbc_, SQL_ATTR_CURRENT_CATALOG, sql_char(val), (SQLINTEGER)val.size());
+    }
+    else
+    {
+        std::u16string buf;
+        unicons::transcode_append(val.data(), val.data() + val.size(), buf);
+        rc = SQLSetConnectAttrW(hdbc_, SQL_ATTR_CURRENT_CATALOG, sql_wchar(buf), 
+                                (SQLINTEGER)(buf.size()*sizeof(char16_t)));
+    }
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+        catalog_.reset();
+        return;
+    }
+    catalog_ = val;
+}
+
+void odbc_connection_impl::row_array_size(size_t val)
+{
+    row_array_size_ = val;
+}
+
+void odbc_connection_impl::execute(const std::string& query, 
+                                   const std::function<void(const row& rec)>& callback,
+                                   std::error_code& ec)
+{
+    statement_impl q(*this, utf8_, ec);
+    if (ec)
+    {
+        return;
+    }
+    q.execute(query,row_array_size_,callback,ec);
+}
+
+void odbc_connection_impl::execute_batches(const std::string& query, 
+                                           size_t batch_size,
+                                           const std::function<void(const record_batch& batch)>& callback,
+                                           std::error_code& ec)
+{
+    statement_impl q(*this, utf8_, ec);
+    if (ec)
+    {
+        return;
+    }
+    q.execute_batches(query,batch_size,callback,ec);
+}
+
+bool odbc_connection_impl::is_valid() const
+{
+    SQLUINTEGER	dead = SQL_CD_TRUE;
+    RETCODE rc = SQLGetConnectAttr(hdbc_, 
+                                   //SQL_COPT_SS_CONNECTION_DEAD,
+                                  SQL_ATTR_CONNECTION_DEAD,
+                                  (SQLPOINTER) &dead,
+                                  (SQLINTEGER) sizeof(dead),
+                                  NULL);
+    return rc == SQL_SUCCESS && dead == SQL_CD_FALSE;
+}
+
+void odbc_connection_impl::execute(const std::string& query, 
+                               std::error_code& ec)
+{
+    statement_impl q(*this, utf8_, ec);
+    if (ec)
+    {
+        return;
+    }
+    q.execute(query,ec);
+}
+
+void odbc_connection_impl::open(const std::string& connString, std::error_code& ec)
 {
-    std::wstring wquery;
-    auto result1 = unicons::convert(query.begin(), query.end(),
-                                    std::back_inserter(wquery), 
-                                    unicons::conv_flags::strict);
+    autoCommit_ = true;
+
+    env_ = odbc_environment::shared(ec);
+    if (ec)
+    {
+        return;
+    }
+
+    RETCODE rc = SQLAllocHandle(SQL_HANDLE_DBC, env_->handle(), &hdbc_);
+    if (rc != SQL_SUCCESS)
+    {
+        handle_diagnostic_record (env_->handle(), SQL_HANDLE_ENV, rc, ec);
+        return;
+    }
+
+    rc = SQLSetConnectAttr(hdbc_, 
+                       SQL_ATTR_AUTOCOMMIT, 
+                       (SQLPOINTER)SQL_AUTOCOMMIT_ON, 
+                       0);
+
+    if (rc != SQL_SUCCESS)
+    {
+        handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+        return;
+    }
+
+    // Connect to the driver.  Use the connection string if supplied 
+    // on the input, otherwise let the driver manager prompt for input. 
+    if (utf8_)
+    {
+        rc = SQLDriverConnect(hdbc_, 
+                              NULL, 
+                              sql_char(connString), 
+                              (SQLSMALLINT)connString.size(), 
+                              NULL, 
+                              0, 
+                              NULL,
+                              SQL_DRIVER_NOPROMPT);
+    }
+    else
+    {
+        std::u16string cs;
+        unicons::transcode_append(connString.data(), connString.data() + connString.size(), cs);
+        rc = SQLDriverConnectW(hdbc_, 
+                               NULL, 
+                               sql_wchar(cs), 
+                               (SQLSMALLINT)cs.size(), 
+                               NULL, 
+                               0, 
+                               NULL,
+                               SQL_DRIVER_NOPROMPT);
+    }
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record (hdbc_, SQL_HANDLE_DBC, rc, ec);
+        return;
+    }
+}
 
+std::unique_ptr<prepared_statement_impl> odbc_connection_impl::prepare_statement(const std::string& query, std::error_code& ec)
+{
     SQLHSTMT    hstmt; 
     RETCODE rc = SQLAllocHandle(SQL_HANDLE_STMT, hdbc_, &hstmt);
     if (rc == SQL_ERROR)
@@ -465,14 +1023,46 @@ std::unique_ptr<prepared_statement_impl> odbc_connection_impl::prepare_statement
         handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
         return std::unique_ptr<odbc_prepared_statement_impl>();
     }
-    rc = SQLPrepare(hstmt, &wquery[0], (SQLINTEGER)wquery.size()); 
+    rc = prepare_query(hstmt, query, utf8_, query_buffer_); 
     if (rc == SQL_ERROR)
     {
         handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+        SQLFreeHandle(SQL_HANDLE_STMT, hstmt);
         return std::unique_ptr<odbc_prepared_statement_impl>();
     }
 
-    return std::make_unique<odbc_prepared_statement_impl>(hstmt);
+    return std::make_unique<odbc_prepared_statement_impl>(hstmt, row_array_size_, utf8_);
+}
+
+SQLHSTMT odbc_connection_impl::acquire_statement(std::error_code& ec)
+{
+    if (!free_statements_.empty())
+    {
+        SQLHSTMT hstmt = free_statements_.back();
+        free_statements_.pop_back();
+        return hstmt;
+    }
+    SQLHSTMT hstmt = nullptr;
+    RETCODE rc = SQLAllocHandle(SQL_HANDLE_STMT, hdbc_, &hstmt);
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+        return nullptr;
+    }
+    return hstmt;
+}
+
+void odbc_connection_impl::release_statement(SQLHSTMT hstmt)
+{
+    if (free_statements_.size() >= max_free_statements)
+    {
+        SQLFreeHandle(SQL_HANDLE_STMT, hstmt);
+        return;
+    }
+    // Result columns were unbound by the rowset's binding_guard
+    SQLFreeStmt(hstmt, SQL_CLOSE);
+    SQLFreeStmt(hstmt, SQL_RESET_PARAMS);
+    free_statements_.push_back(hstmt);
 }
 
 void odbc_connection_impl::commit(std::error_code& ec)
@@ -482,7 +1072,12 @@ void odbc_connection_impl::commit(std::error_code& ec)
         RETCODE rc = SQLEndTran (SQL_HANDLE_DBC, hdbc_, SQL_COMMIT);
         if (rc == SQL_ERROR)
         {
-            ec = make_error_code(odbc_errc::db_err);
+            // The SQLSTATE tells a serialization failure or deadlock from other errors
+            handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+            if (!ec)
+            {
+                ec = make_error_code(odbc_errc::db_err);
+            }
             return;
         }
     }
@@ -495,57 +1090,123 @@ void odbc_connection_impl::rollback(std::error_code& ec)
         RETCODE rc = SQLEndTran (SQL_HANDLE_DBC, hdbc_, SQL_ROLLBACK);
         if (rc == SQL_ERROR)
         {
-            ec = make_error_code(odbc_errc::db_err);
+            handle_diagnostic_record(hdbc_, SQL_HANDLE_DBC, rc, ec);
+            if (!ec)
+            {
+                ec = make_error_code(odbc_errc::db_err);
+            }
             return;
         }
     }
 }
 
 
+// to_double, to_integer
+
+template <class CharT>
+size_t copy_number_text(const CharT* first, const CharT* last, char* buffer, size_t capacity)
+{
+    while (first != last && (*first == ' ' || *first == '+'))
+    {
+        ++first;
+    }
+    size_t length = 0;
+    while (first != last && length < capacity && *first > 0 && *first < 0x80)
+    {
+        buffer[length++] = static_cast<char>(*first++);
+    }
+    return length;
+}
+
+template <class CharT>
+double to_double(const CharT* first, const CharT* last)
+{
+    char buffer[64];
+    size_t length = copy_number_text(first, last, buffer, sizeof(buffer));
+    double val = 0.0;
+    std::from_chars(buffer, buffer + length, val);
+    return val;
+}
+
+template <class CharT>
+int64_t to_integer(const CharT* first, const CharT* last)
+{
+    char buffer[64];
+    size_t length = copy_number_text(first, last, buffer, sizeof(buffer));
+    int64_t val = 0;
+    std::from_chars(buffer, buffer + length, val);
+    return val;
+}
+
 // value_impl
 
 class value_impl : public value
 {
+    const SQLULEN& position_;
 public:
+    value_impl(const SQLULEN& position)
+        : position_(position)
+    {
+    }
+
+    // Index of the current row within the fetched rowset
+    SQLULEN position() const
+    {
+        return position_;
+    }
+
+    virtual column_type type() const = 0;
+
     virtual void bind(SQLHSTMT hstmt, std::error_code& ec) = 0;
     virtual void get_data(SQLHSTMT hstmt, std::error_code& ec) = 0;
+
+    // Appends the first count rows of the rowset to a batch column
+    virtual void append_to(batch_column& column, SQLULEN count, std::error_code& ec) const = 0;
 };
 
 class string_value : public value_impl
 {
 public:
-    std::wstring name_;
+    std::string name_;
     SQLUSMALLINT column_;
     SQLULEN column_size_;
     SQLSMALLINT nullable_;
 
-    std::vector<CHAR> value_;
-    SQLLEN length_or_null_;  // size or null
+    std::vector<char> value_; // one buffer of column_size+1 per row
+    std::vector<SQLLEN> length_or_null_;  // size or null, one per row
 
-    string_value(std::wstring&& name,
+    string_value(std::string&& name,
                  SQLUSMALLINT column,
                  SQLULEN column_size,
-                 SQLSMALLINT nullable)
-        : name_(name),
+                 SQLSMALLINT nullable,
+                 size_t row_array_size,
+                 const SQLULEN& position)
+        : value_impl(position),
+          name_(name),
           column_(column),
           column_size_(column_size),
           nullable_(nullable),
-          length_or_null_(0),
-          value_(column_size+1)
+          value_((column_size+1)*row_array_size),
+          length_or_null_(row_array_size,0)
+    {
+    }
+
+    column_type type() const override
     {
+        return column_type::string_t;
     }
 
     void bind(SQLHSTMT hstmt, std::error_code& ec)
     {
         RETCODE rc;
 
-        size_t buffer_length = value_.size();
+        size_t buffer_length = column_size_+1;
         rc = SQLBindCol(hstmt, 
             column_, 
             SQL_C_CHAR, 
             (SQLPOINTER)&value_[0], 
             buffer_length, 
-            &length_or_null_); 
+            &length_or_null_[0]); 
         if (rc == SQL_ERROR)
         {
             handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
@@ -557,9 +1218,37 @@ public:
     {
     }
 
-    bool is_null() const
+    void append_to(batch_column& column, SQLULEN count, std::error_code& ec) const override
     {
-        return length_or_null_ == SQL_NULL_DATA;
+        for (SQLULEN i = 0; i < count && !ec; ++i)
+        {
+            SQLLEN len = length_or_null_[i];
+            if (len == SQL_NULL_DATA)
+            {
+                column.append_null();
+            }
+            else
+            {
+                size_t n = (len < 0 || (SQLULEN)len > column_size_) ? column_size_ : (size_t)len;
+                column.append_string(value_.data() + i*(column_size_+1), n, ec);
+            }
+        }
+    }
+
+    bool is_null() const override
+    {
+        return length_or_null_[position()] == SQL_NULL_DATA;
+    }
+
+    const char* data() const
+    {
+        return value_.data() + position()*(column_size_+1);
+    }
+
+    size_t length() const
+    {
+        SQLLEN len = length_or_null_[position()];
+        return (len < 0 || (SQLULEN)len > column_size_) ? column_size_ : (size_t)len;
     }
 
     std::wstring as_wstring() const override
@@ -570,11 +1259,8 @@ public:
         }
         else
         {
-            size_t len = length_or_null_;
             std::wstring s;
-            auto result1 = unicons::convert(value_.begin(),value_.begin() + len,
-                                            std::back_inserter(s), 
-                                            unicons::conv_flags::strict);
+            unicons::transcode_append(data(), data() + length(), s);
             return s;
         }
     }
@@ -587,40 +1273,57 @@ public:
         }
         else
         {
-            size_t len = length_or_null_;
-            return std::string(value_.data(), value_.data() + len);
+            return std::string(data(), data() + length());
+        }
+    }
+
+    std::string_view as_string_view() const override
+    {
+        if (is_null())
+        {
+            return std::string_view();
+        }
+        else
+        {
+            return std::string_view(data(), length());
+        }
+    }
+
+    void write_to(std::string& s) const override
+    {
+        if (!is_null())
+        {
+            s.append(data(), length());
         }
     }
 
     double as_double() const override
     {
-        size_t len = length_or_null_;
-        std::istringstream is(std::string(value_.data(), value_.data() + len));
-        double d;
-        is >> d;
-        return d;
+        return is_null() ? 0.0 : to_double(data(), data() + length());
     }
 
     int64_t as_integer() const override
     {
-        return 0;
+        return is_null() ? 0 : to_integer(data(), data() + length());
     }
 };
 
 class long_string_value : public value_impl
 {
 public:
-    std::wstring name_;
+    std::string name_;
     SQLUSMALLINT column_;
     SQLSMALLINT nullable_;
 
-    std::vector<CHAR> value_;
+    std::vector<char> value_;
     SQLLEN length_or_null_;  // size or null
 
-    long_string_value(std::wstring&& name,
+    long_string_value(std::string&& name,
                       SQLUSMALLINT column,
-                      SQLSMALLINT nullable)
-        : name_(name),
+                      SQLSMALLINT nullable,
+                      const SQLULEN& position)
+        : value_impl(position),
+          name_(name),
           column_(column),
           nullable_(nullable),
           length_or_null_(0),
@@ -628,6 +1331,11 @@ public:
     {
     }
 
+    column_type type() const override
+    {
+        return column_type::string_t;
+    }
+
     void bind(SQLHSTMT hstmt, std::error_code& ec)
     {
     }
@@ -695,7 +1403,20 @@ public:
         }
     }
 
-    bool is_null() const
+    // Long data is fetched one row at a time
+    void append_to(batch_column& column, SQLULEN, std::error_code& ec) const override
+    {
+        if (is_null())
+        {
+            column.append_null();
+        }
+        else
+        {
+            column.append_string(value_.data(), (size_t)length_or_null_, ec);
+        }
+    }
+
+    bool is_null() const override
     {
         return length_or_null_ == SQL_NULL_DATA;
     }
@@ -708,11 +1429,8 @@ public:
         }
         else
         {
-            size_t len = length_or_null_;
             std::wstring s;
-            auto result1 = unicons::convert(value_.begin(),value_.begin() + len,
-                                            std::back_inserter(s), 
-                                            unicons::conv_flags::strict);
+            unicons::transcode_append(value_.data(), value_.data() + (size_t)length_or_null_, s);
             return s;
         }
     }
@@ -725,61 +1443,85 @@ public:
         }
         else
         {
-            size_t len = length_or_null_;
-            return std::string(value_.data(), value_.data() + len);
+            return std::string(value_.data(), value_.data() + (size_t)length_or_null_);
+        }
+    }
+
+    std::string_view as_string_view() const override
+    {
+        if (is_null())
+        {
+            return std::string_view();
+        }
+        else
+        {
+            return std::string_view(value_.data(), (size_t)length_or_null_);
+        }
+    }
+
+    void write_to(std::string& s) const override
+    {
+        if (!is_null())
+        {
+            s.append(value_.data(), (size_t)length_or_null_);
         }
     }
 
     double as_double() const override
     {
-        size_t len = length_or_null_;
-        std::istringstream is(std::string(value_.data(), value_.data() + len));
-        double d;
-        is >> d;
-        return d;
+        return is_null() ? 0.0 : to_double(value_.data(), value_.data() + (size_t)length_or_null_);
     }
 
     int64_t as_integer() const override
     {
-        return 0;
+        return is_null() ? 0 : to_integer(value_.data(), value_.data() + (size_t)length_or_null_);
     }
 };
 
 class wstring_value : public value_impl
 {
 public:
-    std::wstring name_;
+    std::string name_;
     SQLUSMALLINT column_;
     SQLULEN column_size_;
     SQLSMALLINT nullable_;
 
-    std::vector<WCHAR> value_;
-    SQLLEN length_or_null_;  // size or null
+    std::vector<char16_t> value_; // one buffer of column_size+1 per row
+    std::vector<SQLLEN> length_or_null_;  // size or null, one per row
+    mutable std::string buffer_; // UTF-8 text for as_string_view
 
-    wstring_value(std::wstring&& name,
+    wstring_value(std::string&& name,
                   SQLUSMALLINT column,
                   SQLULEN column_size,
-                  SQLSMALLINT nullable)
-        : name_(name),
+                  SQLSMALLINT nullable,
+                  size_t row_array_size,
+                  const SQLULEN& position)
+        : value_impl(position),
+          name_(name),
           column_(column),
           column_size_(column_size),
           nullable_(nullable),
-          length_or_null_(0),
-          value_(column_size+1)
+          value_((column_size+1)*row_array_size),
+          length_or_null_(row_array_size,0)
     {
     }
 
+    column_type type() const override
+    {
+        return column_type::string_t;
+    }
+
     void bind(SQLHSTMT hstmt, std::error_code& ec)
     {
         RETCODE rc;
 
-        size_t buffer_length = value_.size();
+        size_t buffer_length = column_size_+1;
         rc = SQLBindCol(hstmt, 
             column_, 
             SQL_C_WCHAR, 
             (SQLPOINTER)&value_[0], 
-            buffer_length * sizeof(WCHAR), 
-            &length_or_null_); 
+            buffer_length * sizeof(char16_t), 
+            &length_or_null_[0]); 
         if (rc == SQL_ERROR)
         {
             handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
@@ -791,9 +1533,37 @@ public:
     {
     }
 
-    bool is_null() const
+    void append_to(batch_column& column, SQLULEN count, std::error_code& ec) const override
     {
-        return length_or_null_ == SQL_NULL_DATA;
+        for (SQLULEN i = 0; i < count && !ec; ++i)
+        {
+            SQLLEN len = length_or_null_[i];
+            if (len == SQL_NULL_DATA)
+            {
+                column.append_null();
+            }
+            else
+            {
+                size_t n = (len < 0 || (SQLULEN)len/sizeof(char16_t) > column_size_) ? column_size_ : (size_t)len/sizeof(char16_t);
+                column.append_string(value_.data() + i*(column_size_+1), n, ec);
+            }
+        }
+    }
+
+    bool is_null() const override
+    {
+        return length_or_null_[position()] == SQL_NULL_DATA;
+    }
+
+    const char16_t* data() const
+    {
+        return value_.data() + position()*(column_size_+1);
+    }
+
+    size_t length() const
+    {
+        SQLLEN len = length_or_null_[position()];
+        return (len < 0 || (SQLULEN)len/sizeof(char16_t) > column_size_) ? column_size_ : (size_t)len/sizeof(char16_t);
     }
 
     std::wstring as_wstring() const override
@@ -804,57 +1574,60 @@ public:
         }
         else
         {
-            size_t len = length_or_null_/sizeof(wchar_t);
-            return std::wstring(value_.data(), value_.data() + len);
+            return to_wstring(data(), data() + length());
         }
     }
 
     std::string as_string() const override
     {
-        if (is_null())
-        {
-            return "";
-        }
-        else
+        std::string s;
+        write_to(s);
+        return s;
+    }
+
+    std::string_view as_string_view() const override
+    {
+        buffer_.clear();
+        write_to(buffer_);
+        return std::string_view(buffer_);
+    }
+
+    void write_to(std::string& s) const override
+    {
+        if (!is_null())
         {
-            size_t len = length_or_null_/sizeof(wchar_t);
-            std::string s;
-            auto result1 = unicons::convert(value_.begin(),value_.begin() + len,
-                                            std::back_inserter(s), 
-                                            unicons::conv_flags::strict);
-            return s;
+            unicons::transcode_append(data(), data() + length(), s);
         }
     }
 
     double as_double() const override
     {
-        size_t len = length_or_null_;
-        std::wistringstream is(std::wstring(value_.data(), value_.data() + len));
-        double d;
-        is >> d;
-        return d;
+        return is_null() ? 0.0 : to_double(data(), data() + length());
     }
 
     int64_t as_integer() const override
     {
-        return 0;
+        return is_null() ? 0 : to_integer(data(), data() + length());
     }
 };
 
 class long_wstring_value : public value_impl
 {
 public:
-    std::wstring name_;
+    std::string name_;
     SQLUSMALLINT column_;
     SQLSMALLINT nullable_;
 
-    std::vector<WCHAR> value_;
+    std::vector<char16_t> value_;
     SQLLEN length_or_null_;  // size or null
+    mutable std::string buffer_; // UTF-8 text for as_string_view
 
-    long_wstring_value(std::wstring&& name,
+    long_wstring_value(std::string&& name,
                        SQLUSMALLINT column,
-                       SQLSMALLINT nullable)
-        : name_(name),
+                       SQLSMALLINT nullable,
+                       const SQLULEN& position)
+        : value_impl(position),
+          name_(name),
           column_(column),
           nullable_(nullable),
           length_or_null_(0),
@@ -862,6 +1635,11 @@ public:
     {
     }
 
+    column_type type() const override
+    {
+        return column_type::string_t;
+    }
+
     void bind(SQLHSTMT hstmt, std::error_code& ec)
     {
     }
@@ -882,7 +1660,7 @@ public:
                             column_, 
                             SQL_C_WCHAR, 
                             (SQLPOINTER)&(value_[offset]), 
-                            size*sizeof(wchar_t), 
+                            size*sizeof(char16_t), 
                             &length_or_null); 
             if (rc == SQL_ERROR)
             {
@@ -904,15 +1682,15 @@ public:
                     else
                     {
                         length_or_null_ = length_or_null;
-                        if (length_or_null/sizeof(wchar_t) < size)
+                        if (length_or_null/sizeof(char16_t) < size)
                         {
                             done = true;
                         }
                         else
                         {
-                            value_.resize(length_or_null/sizeof(wchar_t) + 1);
+                            value_.resize(length_or_null/sizeof(char16_t) + 1);
                             offset += size - 1;
-                            size = length_or_null/sizeof(wchar_t) - offset + 1;
+                            size = length_or_null/sizeof(char16_t) - offset + 1;
                         }
                     }
                     first = false;
@@ -929,11 +1707,23 @@ public:
         }
     }
 
-    bool is_null() const
+    // Long data is fetched one row at a time
+    void append_to(batch_column& column, SQLULEN, std::error_code& ec) const override
     {
-        return length_or_null_ == SQL_NULL_DATA;
+        if (is_null())
+        {
+            column.append_null();
+        }
+        else
+        {
+            column.append_string(value_.data(), (size_t)length_or_null_/sizeof(char16_t), ec);
+        }
     }
 
+    bool is_null() const override
+    {
+        return length_or_null_ == SQL_NULL_DATA;
+    }
 
     std::wstring as_wstring() const override
     {
@@ -943,66 +1733,74 @@ public:
         }
         else
         {
-            size_t len = length_or_null_/sizeof(wchar_t);
-            std::wcout << L"len: " << len << ", str: " << std::wstring(value_.data(), value_.data() + len) << std::endl;
-            return std::wstring(value_.data(), value_.data() + len);
+            return to_wstring(value_.data(), value_.data() + (size_t)length_or_null_/sizeof(char16_t));
         }
     }
 
     std::string as_string() const override
     {
-        if (is_null())
-        {
-            return "";
-        }
-        else
+        std::string s;
+        write_to(s);
+        return s;
+    }
+
+    std::string_view as_string_view() const override
+    {
+        buffer_.clear();
+        write_to(buffer_);
+        return std::string_view(buffer_);
+    }
+
+    void write_to(std::string& s) const override
+    {
+        if (!is_null())
         {
-            size_t len = length_or_null_/sizeof(wchar_t);
-            std::string s;
-            auto result1 = unicons::convert(value_.begin(),value_.begin() + len,
-                                            std::back_inserter(s), 
-                                            unicons::conv_flags::strict);
-            return s;
+            unicons::transcode_append(value_.data(), value_.data() + (size_t)length_or_null_/sizeof(char16_t), s);
         }
     }
 
     double as_double() const override
     {
-        size_t len = length_or_null_;
-        std::wistringstream is(std::wstring(value_.data(), value_.data() + len));
-        double d;
-        is >> d;
-        return d;
+        return is_null() ? 0.0 : to_double(value_.data(), value_.data() + (size_t)length_or_null_/sizeof(char16_t));
     }
 
     int64_t as_integer() const override
     {
-        return 0;
+        return is_null() ? 0 : to_integer(value_.data(), value_.data() + (size_t)length_or_null_/sizeof(char16_t));
     }
 };
 
 class integer_value : public value_impl
 {
 public:
-    std::wstring name_;
+    std::string name_;
     SQLUSMALLINT column_;
     SQLULEN column_size_;
     SQLSMALLINT nullable_;
 
-    int64_t value_;
-    SQLLEN length_or_null_;  // size or null
+    std::vector<int64_t> value_; // one per row
+    std::vector<SQLLEN> length_or_null_;  // size or null, one per row
+    mutable char text_[32]; // text for as_string_view
 
-    integer_value(std::wstring&& name,
+    integer_value(std::string&& name,
                   SQLUSMALLINT column,
                   SQLULEN column_size,
-                  SQLSMALLINT nullable)
-        : name_(name),
+                  SQLSMALLINT nullable,
+                  size_t row_array_size,
+                  const SQLULEN& position)
+        : value_impl(position),
+          name_(name),
           column_(column),
           column_size_(column_size),
           nullable_(nullable),
-          value_(0),
-          length_or_null_(0)
+          value_(row_array_size,0),
+          length_or_null_(row_array_size,0)
+    {
+    }
+
+    column_type type() const override
     {
+        return column_type::integer_t;
     }
 
     void bind(SQLHSTMT hstmt, std::error_code& ec)
@@ -1012,9 +1810,9 @@ public:
         rc = SQLBindCol(hstmt,
             column_, 
             SQL_C_SBIGINT,
-            (SQLPOINTER)&value_, 
+            (SQLPOINTER)&value_[0], 
             0, 
-            &length_or_null_); 
+            &length_or_null_[0]); 
         if (rc == SQL_ERROR)
         {
             handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
@@ -1026,60 +1824,94 @@ public:
     {
     }
 
-    bool is_null() const
+    void append_to(batch_column& column, SQLULEN count, std::error_code&) const override
     {
-        return length_or_null_ == SQL_NULL_DATA;
+        size_t offset = column.size();
+        column.append_integers(value_.data(), count);
+        for (SQLULEN i = 0; i < count; ++i)
+        {
+            if (length_or_null_[i] == SQL_NULL_DATA)
+            {
+                column.set_null(offset + i);
+            }
+        }
+    }
+
+    bool is_null() const override
+    {
+        return length_or_null_[position()] == SQL_NULL_DATA;
     }
 
     std::wstring as_wstring() const override
     {
-        std::wstringstream ss;
-        ss << value_;
-        return ss.str();
+        std::string_view sv = as_string_view();
+        return std::wstring(sv.begin(), sv.end());
     }
 
     std::string as_string() const override
     {
-        std::stringstream ss;
-        ss << value_;
-        return ss.str();
+        return std::string(as_string_view());
+    }
+
+    std::string_view as_string_view() const override
+    {
+        if (is_null())
+        {
+            return std::string_view();
+        }
+        auto result = std::to_chars(text_, text_ + sizeof(text_), value_[position()]);
+        return std::string_view(text_, result.ptr - text_);
+    }
+
+    void write_to(std::string& s) const override
+    {
+        s.append(as_string_view());
     }
 
     double as_double() const override
     {
-        return (double)value_;
+        return (double)value_[position()];
     }
 
     int64_t as_integer() const override
     {
-        return value_;
+        return value_[position()];
     }
 };
 
 class double_value : public value_impl
 {
 public:
-    std::wstring name_;
+    std::string name_;
     SQLUSMALLINT column_;
     SQLULEN column_size_;
     SQLSMALLINT nullable_;
 
-    double value_;
-    SQLLEN length_or_null_;  // size or null
+    std::vector<double> value_; // one per row
+    std::vector<SQLLEN> length_or_null_;  // size or null, one per row
+    mutable char text_[32]; // text for as_string_view
 
-    double_value(std::wstring&& name,
+    double_value(std::string&& name,
                  SQLUSMALLINT column,
                  SQLULEN column_size,
-                 SQLSMALLINT nullable)
-        : name_(name),
+                 SQLSMALLINT nullable,
+                 size_t row_array_size,
+                 const SQLULEN& position)
+        : value_impl(position),
+          name_(name),
           column_(column),
           column_size_(column_size),
           nullable_(nullable),
-          value_(0.0),
-          length_or_null_(0)
+          value_(row_array_size,0.0),
+          length_or_null_(row_array_size,0)
     {
     }
 
+    column_type type() const override
+    {
+        return column_type::double_t;
+    }
+
     void bind(SQLHSTMT hstmt, std::error_code& ec)
     {
         RETCODE rc;
@@ -1087,9 +1919,9 @@ public:
         rc = SQLBindCol(hstmt, 
             column_, 
             SQL_C_DOUBLE,
-            (SQLPOINTER)(&value_), 
+            (SQLPOINTER)&value_[0], 
             0, 
-            &length_or_null_); 
+            &length_or_null_[0]); 
         if (rc == SQL_ERROR)
         {
             handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
@@ -1101,253 +1933,1228 @@ public:
     {
     }
 
-    bool is_null() const
+    void append_to(batch_column& column, SQLULEN count, std::error_code&) const override
     {
-        return length_or_null_ == SQL_NULL_DATA;
+        size_t offset = column.size();
+        column.append_doubles(value_.data(), count);
+        for (SQLULEN i = 0; i < count; ++i)
+        {
+            if (length_or_null_[i] == SQL_NULL_DATA)
+            {
+                column.set_null(offset + i);
+            }
+        }
+    }
+
+    bool is_null() const override
+    {
+        return length_or_null_[position()] == SQL_NULL_DATA;
     }
 
     std::wstring as_wstring() const override
     {
-        std::wstringstream ss;
-        ss << value_;
-        return ss.str();
+        std::string_view sv = as_string_view();
+        return std::wstring(sv.begin(), sv.end());
     }
 
     std::string as_string() const override
     {
-        std::stringstream ss;
-        ss << value_;
-        return ss.str();
+        return std::string(as_string_view());
+    }
+
+    std::string_view as_string_view() const override
+    {
+        if (is_null())
+        {
+            return std::string_view();
+        }
+        auto result = std::to_chars(text_, text_ + sizeof(text_), value_[position()]);
+        return std::string_view(text_, result.ptr - text_);
+    }
+
+    void write_to(std::string& s) const override
+    {
+        s.append(as_string_view());
     }
 
     double as_double() const override
     {
-        return value_;
+        return value_[position()];
     }
 
     int64_t as_integer() const override
     {
-        return value_;
+        return (int64_t)value_[position()];
     }
 };
 
 
-// statement_impl
+// column_description
 
-void statement_impl::execute(const std::string& query, 
-                             const std::function<void(const row& rec)>& callback,
-                             std::error_code& ec)
+struct column_description
 {
-    std::wstring buf;
-    auto result1 = unicons::convert(query.begin(), query.end(),
-                                    std::back_inserter(buf), 
-                                    unicons::conv_flags::strict);
+    std::string name; // UTF-8
+    SQLUSMALLINT column;
+    SQLSMALLINT data_type;
+    SQLULEN column_size;
+    SQLSMALLINT decimal_digits;
+    SQLSMALLINT nullable;
+};
 
-    RETCODE rc = SQLExecDirect(hstmt_, &buf[0], (SQLINTEGER)buf.size()); 
-    if (rc == SQL_ERROR)
+// rowset
+
+class rowset
+{
+    size_t row_array_size_;
+    bool utf8_;
+    size_t num_columns_;
+    std::vector<std::unique_ptr<value_impl>> values_;
+    column_index index_; // UTF-8 column names, parallel to values_
+    row row_;
+    std::vector<SQLUSMALLINT> row_status_;
+    SQLULEN rows_fetched_;
+    SQLULEN position_;
+public:
+    rowset(size_t row_array_size, bool utf8)
+        : row_array_size_(row_array_size == 0 ? 1 : row_array_size),
+          utf8_(utf8),
+          num_columns_(0),
+          row_(std::vector<value*>()),
+          rows_fetched_(0),
+          position_(0)
     {
-        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
-        return;
     }
 
-    process_results(hstmt_, callback, ec);
-}
+    rowset(const rowset&) = delete;
+    rowset& operator=(const rowset&) = delete;
 
-void statement_impl::execute(const std::string& query, 
-                             std::error_code& ec)
-{
-    std::wstring buf;
-    auto result1 = unicons::convert(query.begin(), query.end(),
-                                    std::back_inserter(buf), 
-                                    unicons::conv_flags::strict);
+    size_t row_array_size() const
+    {
+        return row_array_size_;
+    }
 
-    RETCODE rc = SQLExecDirect(hstmt_, &buf[0], (SQLINTEGER)buf.size()); 
-    if (rc == SQL_ERROR)
+    size_t num_columns() const
     {
-        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
-        return;
+        return num_columns_;
     }
-}
 
-// odbc_prepared_statement_impl
+    void describe(SQLHSTMT hstmt, std::error_code& ec);
 
-odbc_prepared_statement_impl::odbc_prepared_statement_impl()
-    : hstmt_(nullptr)
-{
-}
+    void bind(SQLHSTMT hstmt, std::error_code& ec);
 
-odbc_prepared_statement_impl::odbc_prepared_statement_impl(SQLHSTMT hstmt)
-    : hstmt_(hstmt)
-{
-}
+    void unbind(SQLHSTMT hstmt);
 
-void odbc_prepared_statement_impl::execute_(std::vector<std::unique_ptr<parameter_base>>& bindings, 
-                                            const std::function<void(const row& rec)>& callback,
-                                            std::error_code& ec)
+    // Closes the cursor and unbinds the rowset's columns and row status buffers at scope exit, 
+    // also when a result callback throws, so that a statement handle kept for reuse does not 
+    // point into a rowset that is gone
+    class binding_guard
+    {
+        rowset& rs_;
+        SQLHSTMT hstmt_;
+    public:
+        binding_guard(rowset& rs, SQLHSTMT hstmt)
+            : rs_(rs), hstmt_(hstmt)
+        {
+        }
+
+        binding_guard(const binding_guard&) = delete;
+        binding_guard& operator=(const binding_guard&) = delete;
+
+        ~binding_guard()
+        {
+            SQLCloseCursor(hstmt_);
+            rs_.unbind(hstmt_);
+        }
+    };
+
+    void fetch(SQLHSTMT hstmt,
+               const std::function<void(const row& rec)>& callback,
+               std::error_code& ec);
+
+    void fetch_batches(SQLHSTMT hstmt,
+                       size_t batch_size,
+                       const std::function<void(const record_batch& batch)>& callback,
+                       std::error_code& ec);
+};
+
+void describe_columns(SQLHSTMT hstmt,
+                      bool utf8,
+                      std::vector<column_description>& columns,
+                      std::error_code& ec)
 {
     RETCODE rc;
 
-    std::vector<SQLLEN> lengths(bindings.size());
+    SQLSMALLINT numColumns; 
+    rc = SQLNumResultCols(hstmt,&numColumns);
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+        return;
+    }
+    columns.reserve(numColumns);
 
-    for (size_t i = 0; i < bindings.size(); ++i)
+    // Names are in characters, a name that doesn't fit is described again with a larger buffer
+    std::vector<SQLWCHAR> wname;
+    std::vector<SQLCHAR> name;
+    if (utf8)
     {
-        lengths[i] = bindings[i]->buffer_length();
-        //std::cout << "column_size: " << bindings[i]->column_size() << std::endl;
-        rc = SQLBindParameter(hstmt_, 
-                              i+1, 
-                              SQL_PARAM_INPUT, 
-                              bindings[i]->value_type(), 
-                              bindings[i]->parameter_type(), 
-                              bindings[i]->column_size(), 
-                              0,
-                              bindings[i]->pvalue(), 
-                              bindings[i]->buffer_capacity(),
-                              &lengths[i]);
-        if (rc == SQL_ERROR)
+        name.resize(256);
+    }
+    else
+    {
+        wname.resize(256);
+    }
+    for (SQLUSMALLINT col = 1; col <= numColumns; col++) 
+    { 
+        SQLSMALLINT nameLength;
+        SQLSMALLINT dataType;
+        SQLULEN column_size;
+        SQLSMALLINT decimalDigits;
+        SQLSMALLINT nullable;
+        bool retried = false;
+        for (;;)
         {
-            handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
-            return;
+            size_t buffer_length = utf8 ? name.size() : wname.size();
+            if (utf8)
+            {
+                rc = SQLDescribeCol(hstmt,  
+                                    col,  
+                                    name.data(),  
+                                    (SQLSMALLINT)buffer_length,  
+                                    &nameLength,  
+                                    &dataType,  
+                                    &column_size,  
+                                    &decimalDigits,  
+                                    &nullable);  
+            }
+            else
+            {
+                rc = SQLDescribeColW(hstmt,  
+                                     col,  
+                                     wname.data(),  
+                                     (SQLSMALLINT)buffer_length,  
+                                     &nameLength,  
+                                     &dataType,  
+                                     &column_size,  
+                                     &decimalDigits,  
+                                     &nullable);  
+            }
+            if (rc == SQL_ERROR)
+            {
+                handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+                return;
+            }
+            if (retried || nameLength < 0 || (size_t)nameLength < buffer_length)
+            {
+                break;
+            }
+            retried = true;
+            size_t new_length = (std::min)((size_t)nameLength + 1, (size_t)(std::numeric_limits<SQLSMALLINT>::max)());
+            if (utf8)
+            {
+                name.resize(new_length);
+            }
+            else
+            {
+                wname.resize(new_length);
+            }
+        }
+        size_t max_length = (utf8 ? name.size() : wname.size()) - 1;
+        if (nameLength < 0)
+        {
+            nameLength = 0;
+        }
+        else if ((size_t)nameLength > max_length)
+        {
+            nameLength = (SQLSMALLINT)max_length;
+        }
+        std::string s;
+        if (utf8)
+        {
+            s.assign((const char*)name.data(), nameLength);
+        }
+        else
+        {
+            const char16_t* p = reinterpret_cast<const char16_t*>(wname.data());
+            unicons::transcode_append(p, p + nameLength, s, unicons::conv_flags::lenient);
+        }
+
+        switch (dataType)
+        {
+        case SQL_DATE:
+        case SQL_TYPE_DATE:
+        case SQL_TYPE_TIMESTAMP:
+            {
+                SQLLEN displaySize = 0; 
+                rc = SQLColAttribute(hstmt, 
+                                     col, 
+                                     SQL_DESC_DISPLAY_SIZE, 
+                                     NULL, 
+                                     0, 
+                                     NULL, 
+                                     &displaySize);
+                if (rc == SQL_ERROR)
+                {
+                    handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+                    return;
+                }
+                column_size = (SQLULEN)displaySize;
+            }
+            break;
+        default:
+            break;
         }
+        columns.push_back(column_description{std::move(s),col,dataType,column_size,decimalDigits,nullable});
     }
+}
 
-    rc = SQLExecute(hstmt_); 
-    if (rc == SQL_ERROR)
+void rowset::describe(SQLHSTMT hstmt, std::error_code& ec)
+{
+    std::vector<column_description> columns;
+    describe_columns(hstmt, utf8_, columns, ec);
+    if (ec)
     {
-        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
         return;
     }
+    num_columns_ = columns.size();
 
-    if (rc == SQL_PARAM_DATA_AVAILABLE)
+    // Long data must be retrieved row by row with SQLGetData
+    for (const auto& desc : columns)
     {
-        std::cout << "SQL_PARAM_DATA_AVAILABLE" << std::endl;
+        if (desc.data_type == SQL_LONGVARCHAR || desc.data_type == SQL_WLONGVARCHAR)
+        {
+            row_array_size_ = 1;
+        }
     }
-    if (rc == NO_DATA)
+
+    values_.clear();
+    values_.reserve(columns.size());
+    std::vector<std::string> names;
+    names.reserve(columns.size());
+    for (auto& desc : columns)
     {
-        std::cout << "NO_DATA" << std::endl;
+        std::string name = desc.name;
+        size_t count = values_.size();
+        switch (desc.data_type)
+        {
+        case SQL_DATE:
+        case SQL_TYPE_DATE:
+        case SQL_TYPE_TIMESTAMP:
+        case SQL_VARCHAR:
+        case SQL_CHAR:
+            values_.push_back(std::make_unique<string_value>(std::move(desc.name),
+                                                             desc.column,
+                                                             desc.column_size,
+                                                             desc.nullable,
+                                                             row_array_size_,
+                                                             position_));
+            break;
+        case SQL_LONGVARCHAR:
+            values_.push_back(std::make_unique<long_string_value>(std::move(desc.name),
+                                                                  desc.column,
+                                                                  desc.nullable,
+                                                                  position_));
+            break;
+        case SQL_WVARCHAR:
+        case SQL_WCHAR:
+            if (utf8_)
+            {
+                // A UTF-16 code unit takes at most three UTF-8 bytes
+                values_.push_back(std::make_unique<string_value>(std::move(desc.name),
+                                                                 desc.column,
+                                                                 desc.column_size*3,
+                                                                 desc.nullable,
+                                                                 row_array_size_,
+                                                                 position_));
+                break;
+            }
+            values_.push_back(std::make_unique<wstring_value>(std::move(desc.name),
+                                                              desc.column,
+                                                              desc.column_size,
+                                                              desc.nullable,
+                                                              row_array_size_,
+                                                              position_));
+            break;
+        case SQL_WLONGVARCHAR:
+            if (utf8_)
+            {
+                values_.push_back(std::make_unique<long_string_value>(std::move(desc.name),
+                                                                      desc.column,
+                                                                      desc.nullable,
+                                                                      position_));
+                break;
+            }
+            values_.push_back(std::make_unique<long_wstring_value>(std::move(desc.name),
+                                                                   desc.column,
+                                                                   desc.nullable,
+                                                                   position_));
+            break;
+        case SQL_SMALLINT:
+        case SQL_TINYINT:
+        case SQL_INTEGER:
+        case SQL_BIGINT:
+            values_.push_back(std::make_unique<integer_value>(std::move(desc.name),
+                                                              desc.column,
+                                                              desc.column_size,
+                                                              desc.nullable,
+                                                              row_array_size_,
+                                                              position_));
+            break;
+        case SQL_DECIMAL:
+        case SQL_NUMERIC:
+        case SQL_REAL:
+        case SQL_FLOAT:
+        case SQL_DOUBLE:
+            values_.push_back(std::make_unique<double_value>(std::move(desc.name),
+                                                             desc.column,
+                                                             desc.column_size,
+                                                             desc.nullable,
+                                                             row_array_size_,
+                                                             position_));
+            break;
+        default:
+            break;
+        }
+        if (values_.size() > count)
+        {
+            names.push_back(std::move(name));
+        }
     }
-    if (rc == SQL_NEED_DATA)
+
+    std::vector<value*> cols;
+    cols.reserve(values_.size());
+    for (auto& c : values_)
     {
-        std::cout << "SQL_NEED_DATA" << std::endl;
+        cols.push_back(c.get());
     }
+    index_.assign(std::move(names));
+    row_ = row(std::move(cols), &index_);
 
-    process_results(hstmt_, callback, ec);
+    row_status_.resize(row_array_size_);
 }
 
-void odbc_prepared_statement_impl::execute_(std::vector<std::unique_ptr<parameter_base>>& bindings, 
-                                          std::error_code& ec)
+void rowset::bind(SQLHSTMT hstmt, std::error_code& ec)
 {
     RETCODE rc;
 
-    std::vector<SQLLEN> lengths(bindings.size());
-
-    for (size_t i = 0; i < bindings.size(); ++i)
+    rc = SQLSetStmtAttr(hstmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0);
+    if (rc == SQL_ERROR)
     {
-        lengths[i] = bindings[i]->buffer_length();
-        //std::cout << "column_size: " << bindings[i]->column_size() << std::endl;
-        rc = SQLBindParameter(hstmt_, 
-                              i+1, 
-                              SQL_PARAM_INPUT, 
-                              bindings[i]->value_type(), 
-                              bindings[i]->parameter_type(), 
-                              bindings[i]->column_size(), 
-                              0,
-                              bindings[i]->pvalue(), 
-                              bindings[i]->buffer_capacity(), 
-                              &lengths[i]);
-        if (rc == SQL_ERROR)
-        {
-            handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
-            return;
-        }
+        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+        return;
     }
-
-    rc = SQLExecute(hstmt_); 
+    rc = SQLSetStmtAttr(hstmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)row_array_size_, 0);
     if (rc == SQL_ERROR)
     {
-        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
         return;
     }
-
-    if (rc == SQL_PARAM_DATA_AVAILABLE)
+    rc = SQLSetStmtAttr(hstmt, SQL_ATTR_ROW_STATUS_PTR, (SQLPOINTER)&row_status_[0], 0);
+    if (rc == SQL_ERROR)
     {
-        //std::cout << "SQL_PARAM_DATA_AVAILABLE" << std::endl;
+        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+        return;
     }
-    if (rc == NO_DATA)
+    rc = SQLSetStmtAttr(hstmt, SQL_ATTR_ROWS_FETCHED_PTR, (SQLPOINTER)&rows_fetched_, 0);
+    if (rc == SQL_ERROR)
     {
-        std::cout << "NO_DATA" << std::endl;
+        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+        return;
     }
-    if (rc == SQL_NEED_DATA)
+    for (auto& value : values_)
     {
-        std::cout << "SQL_NEED_DATA" << std::endl;
+        value->bind(hstmt, ec);
+        if (ec)
+        {
+            return;
+        }
     }
 }
 
-// compare_states
+void rowset::unbind(SQLHSTMT hstmt)
+{
+    SQLFreeStmt(hstmt, SQL_UNBIND);
+    SQLSetStmtAttr(hstmt, SQL_ATTR_ROW_STATUS_PTR, NULL, 0);
+    SQLSetStmtAttr(hstmt, SQL_ATTR_ROWS_FETCHED_PTR, NULL, 0);
+    SQLSetStmtAttr(hstmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)1, 0);
+}
 
-struct compare_states
+void rowset::fetch(SQLHSTMT hstmt,
+                   const std::function<void(const row& rec)>& callback,
+                   std::error_code& ec)
 {
-    bool operator()(const wchar_t* key1, const wchar_t* key2) const
+    RETCODE rc;
+
+    bool done = false;
+    while (!done)
     {
-        return wcsncmp(key1, key2, 5) < 0;
+        // Fetch a rowset
+        rows_fetched_ = 0;
+        rc = SQLFetch(hstmt);
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+            return;
+        }
+        if (rc == SQL_NO_DATA)
+        {
+            done = true;
+        }
+        else
+        {
+            for (position_ = 0; position_ < rows_fetched_; ++position_)
+            {
+                if (row_status_[position_] == SQL_ROW_ERROR || row_status_[position_] == SQL_ROW_NOROW)
+                {
+                    continue;
+                }
+                // Get long data values here
+                for (auto& value : values_)
+                {
+                    value->get_data(hstmt,ec);
+                    if (ec)
+                    {
+                        return;
+                    }
+                }
+                callback(row_);
+            }
+        }
     }
-};
+    position_ = 0;
+}
 
-struct odbc_error_codes
-{
-    std::map<const wchar_t*,odbc_errc,compare_states> code_map;
+// statement_impl
+
+void statement_impl::execute(const std::string& query, 
+                             size_t row_array_size,
+                             const std::function<void(const row& rec)>& callback,
+                             std::error_code& ec)
+{
+    RETCODE rc = execute_query(hstmt_, query, utf8_, conn_.query_buffer()); 
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        return;
+    }
+
+    process_results(hstmt_, row_array_size, utf8_, callback, ec);
+}
+
+void statement_impl::execute(const std::string& query, 
+                             std::error_code& ec)
+{
+    RETCODE rc = execute_query(hstmt_, query, utf8_, conn_.query_buffer()); 
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        return;
+    }
+}
+
+void statement_impl::execute_batches(const std::string& query, 
+                                     size_t batch_size,
+                                     const std::function<void(const record_batch& batch)>& callback,
+                                     std::error_code& ec)
+{
+    RETCODE rc = execute_query(hstmt_, query, utf8_, conn_.query_buffer()); 
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        return;
+    }
+
+    process_batches(hstmt_, batch_size, utf8_, callback, ec);
+}
+
+// odbc_prepared_statement_impl
+
+odbc_prepared_statement_impl::odbc_prepared_statement_impl()
+    : hstmt_(nullptr), row_array_size_(default_row_array_size), initial_row_array_size_(default_row_array_size), 
+      utf8_(false), rowset_size_(0), columns_described_(false)
+{
+}
+
+odbc_prepared_statement_impl::odbc_prepared_statement_impl(SQLHSTMT hstmt, size_t row_array_size, bool utf8)
+    : hstmt_(hstmt), row_array_size_(row_array_size), initial_row_array_size_(row_array_size), 
+      utf8_(utf8), rowset_size_(0), columns_described_(false)
+{
+}
+
+odbc_prepared_statement_impl::~odbc_prepared_statement_impl()
+{
+    if (hstmt_) 
+    { 
+        SQLFreeHandle(SQL_HANDLE_STMT, hstmt_); 
+    } 
+}
+
+// Returns the rowset for the current result set, describing and binding the columns 
+// again only when the number of columns has changed, after a fetch has failed because 
+// the bound types no longer fit, or after refresh_columns_
+
+rowset* odbc_prepared_statement_impl::result_rowset(size_t row_array_size, std::error_code& ec)
+{
+    SQLSMALLINT numColumns = 0; 
+    RETCODE rc = SQLNumResultCols(hstmt_,&numColumns);
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        SQLCloseCursor(hstmt_);
+        return nullptr;
+    }
+    if (numColumns == 0)
+    {
+        return nullptr;
+    }
+    if (!rowset_ || rowset_size_ != row_array_size || rowset_->num_columns() != (size_t)numColumns)
+    {
+        reset_rowset();
+
+        auto rs = std::make_unique<rowset>(row_array_size, utf8_);
+        rs->describe(hstmt_, ec);
+        if (ec)
+        {
+            SQLCloseCursor(hstmt_);
+            return nullptr;
+        }
+        rs->bind(hstmt_, ec);
+        if (ec)
+        {
+            rs->unbind(hstmt_);
+            SQLCloseCursor(hstmt_);
+            return nullptr;
+        }
+        rowset_ = std::move(rs);
+        rowset_size_ = row_array_size;
+    }
+    return rowset_.get();
+}
+
+// A fetch into buffers whose types no longer match the result, e.g. after a table 
+// was altered, fails with 07006 or HY003
+bool is_column_type_error(const std::error_code& ec)
+{
+    return ec == make_error_code(odbc_errc::E_07006) || ec == make_error_code(odbc_errc::E_HY003);
+}
+
+void odbc_prepared_statement_impl::reset_rowset()
+{
+    if (rowset_)
+    {
+        rowset_->unbind(hstmt_);
+        rowset_.reset();
+    }
+}
+
+void odbc_prepared_statement_impl::execute_batches_(const parameter_binding* params, size_t count,
+                                                    size_t batch_size,
+                                                    const std::function<void(const record_batch& batch)>& callback,
+                                                    std::error_code& ec)
+{
+    execute_statement(params, count, ec);
+    if (ec)
+    {
+        return;
+    }
+    rowset* rs = result_rowset(batch_size, ec);
+    if (rs == nullptr)
+    {
+        return;
+    }
+    rs->fetch_batches(hstmt_, batch_size, callback, ec);
+    SQLCloseCursor(hstmt_);
+    if (is_column_type_error(ec))
+    {
+        reset_rowset();
+    }
+}
+
+void odbc_prepared_statement_impl::execute_(const parameter_binding* params, size_t count,
+                                            const std::function<void(const row& rec)>& callback,
+                                            std::error_code& ec)
+{
+    execute_statement(params, count, ec);
+    if (ec)
+    {
+        return;
+    }
+    fetch_results(callback, ec);
+}
+
+void odbc_prepared_statement_impl::execute_(const parameter_binding* params, size_t count,
+                                            std::error_code& ec)
+{
+    execute_statement(params, count, ec);
+}
+
+void odbc_prepared_statement_impl::fetch_results(const std::function<void(const row& rec)>& callback,
+                                                 std::error_code& ec)
+{
+    rowset* rs = result_rowset(row_array_size_, ec);
+    if (rs == nullptr)
+    {
+        return;
+    }
+    rs->fetch(hstmt_, callback, ec);
+    SQLCloseCursor(hstmt_);
+    if (is_column_type_error(ec))
+    {
+        reset_rowset();
+    }
+}
+
+void odbc_prepared_statement_impl::execute_statement(const parameter_binding* params, size_t count, 
+                                                     std::error_code& ec)
+{
+    RETCODE rc;
+
+    if (bound_params_.size() != count)
+    {
+        unbind_parameters();
+        bound_params_.resize(count);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const parameter_binding& param = params[i];
+        bound_parameter& bp = bound_params_[i];
+
+        // Where the value goes, and how the parameter would be bound for it
+        SQLPOINTER buffer = bp.value;
+        SQLULEN column_size = param.column_size;
+        SQLLEN buffer_length = (SQLLEN)param.length;
+        if (param.value == nullptr)
+        {
+            bp.ind = SQL_NULL_DATA;
+            if (bp.bound)
+            {
+                buffer = bp.buffer;
+                column_size = bp.column_size;
+                buffer_length = bp.buffer_length;
+            }
+            else if (param.is_text)
+            {
+                column_size = 1;
+            }
+        }
+        else if (param.is_text && param.c_type_identifier == SQL_C_CHAR)
+        {
+            // UTF-8 mode, the text is copied as is
+            size_t capacity = bp.grow_capacity(param.length);
+            bp.bytes.reserve(capacity);
+            bp.bytes.assign(static_cast<const char*>(param.value), param.length);
+            bp.ind = (SQLLEN)bp.bytes.size();
+            buffer = &bp.bytes[0];
+            column_size = capacity > 0 ? capacity : 1;
+            buffer_length = (SQLLEN)(capacity+1);
+        }
+        else if (param.is_text)
+        {
+            const char* p = static_cast<const char*>(param.value);
+            bp.text.clear();
+            unicons::transcode_append(p, p + param.length, bp.text);
+            size_t capacity = bp.grow_capacity(bp.text.size());
+            bp.text.reserve(capacity+1);
+            bp.ind = (SQLLEN)(bp.text.size()*sizeof(char16_t));
+            bp.text.push_back(0);
+            buffer = &bp.text[0];
+            column_size = capacity > 0 ? capacity : 1;
+            buffer_length = (SQLLEN)((capacity+1)*sizeof(char16_t));
+        }
+        else
+        {
+            if (param.length > sizeof(bp.value))
+            {
+                ec = std::make_error_code(std::errc::invalid_argument);
+                return;
+            }
+            memcpy(bp.value, param.value, param.length);
+            bp.ind = (SQLLEN)param.length;
+        }
+
+        // Rebind only if the type changed or the value no longer fits the bound buffer
+        if (!bp.bound || 
+            bp.c_type_identifier != (SQLSMALLINT)param.c_type_identifier ||
+            bp.sql_type_identifier != (SQLSMALLINT)param.sql_type_identifier ||
+            bp.buffer != buffer ||
+            bp.column_size < column_size ||
+            bp.buffer_length < buffer_length)
+        {
+            rc = SQLBindParameter(hstmt_, 
+                                  (SQLUSMALLINT)(i+1), 
+                                  SQL_PARAM_INPUT, 
+                                  (SQLSMALLINT)param.c_type_identifier, 
+                                  (SQLSMALLINT)param.sql_type_identifier, 
+                                  column_size, 
+                                  0,
+                                  buffer, 
+                                  buffer_length, 
+                                  &bp.ind);
+            if (rc == SQL_ERROR)
+            {
+                bp.bound = false;
+                handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+                return;
+            }
+            bp.c_type_identifier = (SQLSMALLINT)param.c_type_identifier;
+            bp.sql_type_identifier = (SQLSMALLINT)param.sql_type_identifier;
+            bp.buffer = buffer;
+            bp.column_size = column_size;
+            bp.buffer_length = buffer_length;
+            bp.bound = true;
+        }
+    }
+
+    rc = SQLExecute(hstmt_); 
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+    }
+}
+
+void odbc_prepared_statement_impl::unbind_parameters()
+{
+    if (!bound_params_.empty())
+    {
+        SQLFreeStmt(hstmt_, SQL_RESET_PARAMS);
+        bound_params_.clear();
+    }
+}
+
+
+// Sets the size and status arrays of a parameter set, drivers without parameter 
+// arrays reject these with HYC00
+bool set_paramset(SQLHSTMT hstmt, SQLULEN size, SQLUSMALLINT* status, SQLULEN* processed, 
+                  std::error_code& ec)
+{
+    RETCODE rc = SQLSetStmtAttr(hstmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)size, 0);
+    if (rc != SQL_ERROR)
+    {
+        rc = SQLSetStmtAttr(hstmt, SQL_ATTR_PARAM_STATUS_PTR, status, 0);
+    }
+    if (rc != SQL_ERROR)
+    {
+        rc = SQLSetStmtAttr(hstmt, SQL_ATTR_PARAMS_PROCESSED_PTR, processed, 0);
+    }
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+        return false;
+    }
+    return true;
+}
+
+void odbc_prepared_statement_impl::execute_array_(std::vector<std::unique_ptr<parameter_array_base>>& columns, 
+                                                  size_t count,
+                                                  param_status* status,
+                                                  std::error_code& ec)
+{
+    RETCODE rc;
+
+    unbind_parameters();
+
+    SQLULEN processed = 0;
+    param_status_.assign(count, SQL_PARAM_UNUSED);
+    param_lengths_.resize(columns.size());
+
+    bool bound;
+    rc = SQLSetStmtAttr(hstmt_, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER)SQL_PARAM_BIND_BY_COLUMN, 0);
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        bound = false;
+    }
+    else
+    {
+        bound = set_paramset(hstmt_, count, param_status_.data(), &processed, ec);
+    }
+
+    for (size_t i = 0; bound && i < columns.size(); ++i)
+    {
+        SQLLEN* plengths = nullptr;
+        const int64_t* lengths = columns[i]->lengths();
+        if (lengths != nullptr)
+        {
+            param_lengths_[i].resize(count);
+            for (size_t j = 0; j < count; ++j)
+            {
+                param_lengths_[i][j] = lengths[j] < 0 ? SQL_NULL_DATA : (SQLLEN)lengths[j];
+            }
+            plengths = param_lengths_[i].data();
+        }
+        rc = SQLBindParameter(hstmt_, 
+                              (SQLUSMALLINT)(i+1), 
+                              SQL_PARAM_INPUT, 
+                              columns[i]->value_type(), 
+                              columns[i]->parameter_type(), 
+                              columns[i]->column_size(), 
+                              0,
+                              columns[i]->pvalue(), 
+                              columns[i]->element_length(), 
+                              plengths);
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+            bound = false;
+        }
+    }
+
+    if (bound)
+    {
+        // Rows that fail give SQL_SUCCESS_WITH_INFO, SQL_ERROR means the whole set failed
+        rc = SQLExecute(hstmt_); 
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        }
+        for (size_t j = 0; j < count; ++j)
+        {
+            switch (param_status_[j])
+            {
+            case SQL_PARAM_SUCCESS:
+                status[j] = param_status::success;
+                break;
+            case SQL_PARAM_SUCCESS_WITH_INFO:
+                status[j] = param_status::success_with_info;
+                break;
+            case SQL_PARAM_ERROR:
+                status[j] = param_status::error;
+                break;
+            case SQL_PARAM_DIAG_UNAVAILABLE:
+                status[j] = param_status::diag_unavailable;
+                break;
+            default:
+                status[j] = param_status::unused;
+                break;
+            }
+        }
+        SQLFreeStmt(hstmt_, SQL_CLOSE);
+    }
+
+    // Restore single row execution for execute_, processed is about to go out of scope
+    SQLFreeStmt(hstmt_, SQL_RESET_PARAMS);
+    std::error_code reset_ec;
+    if (!set_paramset(hstmt_, 1, nullptr, nullptr, reset_ec) && !ec)
+    {
+        ec = reset_ec;
+    }
+}
+
+void odbc_prepared_statement_impl::bind_columns_(const column_binding* columns, size_t count, std::error_code& ec)
+{
+    reset_rowset();
+
+    bound_columns_.assign(columns, columns + count);
+    indicators_.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        RETCODE rc = SQLBindCol(hstmt_, 
+                                (SQLUSMALLINT)columns[i].column, 
+                                (SQLSMALLINT)columns[i].c_type_identifier, 
+                                (SQLPOINTER)columns[i].buffer, 
+                                (SQLLEN)columns[i].buffer_length, 
+                                &indicators_[i]); 
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+            return;
+        }
+    }
+}
+
+bool odbc_prepared_statement_impl::fetch_(std::error_code& ec)
+{
+    RETCODE rc = SQLFetch(hstmt_);
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        return false;
+    }
+    if (rc == SQL_NO_DATA)
+    {
+        return false;
+    }
+    // The driver leaves the buffer of a null column untouched
+    for (size_t i = 0; i < bound_columns_.size(); ++i)
+    {
+        if (indicators_[i] == SQL_NULL_DATA)
+        {
+            memset(bound_columns_[i].buffer, 0, bound_columns_[i].buffer_length);
+        }
+    }
+    return true;
+}
+
+void odbc_prepared_statement_impl::get_data_(size_t column, int c_type_identifier, void* buffer, size_t buffer_length, std::error_code& ec)
+{
+    SQLLEN length_or_null = 0;
+    RETCODE rc = SQLGetData(hstmt_, 
+                            (SQLUSMALLINT)column, 
+                            (SQLSMALLINT)c_type_identifier, 
+                            (SQLPOINTER)buffer, 
+                            (SQLLEN)buffer_length, 
+                            &length_or_null); 
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        return;
+    }
+    if (rc == SQL_NO_DATA || length_or_null == SQL_NULL_DATA)
+    {
+        memset(buffer, 0, buffer_length);
+    }
+}
+
+void odbc_prepared_statement_impl::get_string_(size_t column, std::string& s, std::error_code& ec)
+{
+    s.clear();
+    if (utf8_)
+    {
+        get_bytes(column, s, ec);
+        return;
+    }
+    if (buffer_.empty())
+    {
+        buffer_.resize(1024);
+    }
+
+    // A high surrogate that ends a chunk is carried to the front of the next, 
+    // so that a pair split across chunks is transcoded whole
+    size_t carried = 0;
+    bool done = false;
+    while (!done)
+    {
+        SQLLEN length_or_null = 0;
+        RETCODE rc = SQLGetData(hstmt_, 
+                                (SQLUSMALLINT)column, 
+                                SQL_C_WCHAR, 
+                                (SQLPOINTER)&buffer_[carried], 
+                                (buffer_.size() - carried)*sizeof(char16_t), 
+                                &length_or_null); 
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+            return;
+        }
+        size_t len = carried;
+        if (rc == SQL_NO_DATA || length_or_null == SQL_NULL_DATA)
+        {
+            done = true;
+        }
+        else
+        {
+            // A truncated chunk fills the buffer except for the null terminator
+            size_t available = buffer_.size() - carried;
+            len += (length_or_null == SQL_NO_TOTAL || (size_t)length_or_null/sizeof(char16_t) >= available) 
+                ? available - 1 
+                : (size_t)length_or_null/sizeof(char16_t);
+            done = rc == SQL_SUCCESS;
+        }
+        carried = 0;
+        if (!done && len > 0 && buffer_[len-1] >= 0xD800 && buffer_[len-1] <= 0xDBFF)
+        {
+            carried = 1;
+            --len;
+        }
+        auto result = unicons::transcode_append(buffer_.data(), buffer_.data() + len, s);
+        if (result != unicons::conv_errc())
+        {
+            ec = unicons::make_error_code(result);
+            return;
+        }
+        if (carried != 0)
+        {
+            buffer_[0] = buffer_[len];
+        }
+    }
+}
+
+// Reads a SQL_C_CHAR column in chunks, appending the bytes to s without transcoding
+
+void odbc_prepared_statement_impl::get_bytes(size_t column, std::string& s, std::error_code& ec)
+{
+    if (bytes_.empty())
+    {
+        bytes_.resize(1024);
+    }
+
+    bool done = false;
+    while (!done)
+    {
+        SQLLEN length_or_null = 0;
+        RETCODE rc = SQLGetData(hstmt_, 
+                                (SQLUSMALLINT)column, 
+                                SQL_C_CHAR, 
+                                (SQLPOINTER)&bytes_[0], 
+                                bytes_.size(), 
+                                &length_or_null); 
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+            return;
+        }
+        if (rc == SQL_NO_DATA || length_or_null == SQL_NULL_DATA)
+        {
+            done = true;
+        }
+        else
+        {
+            size_t len = (length_or_null == SQL_NO_TOTAL || (size_t)length_or_null >= bytes_.size()) 
+                ? bytes_.size() - 1 
+                : (size_t)length_or_null;
+            s.append(bytes_.data(), len);
+            done = rc == SQL_SUCCESS;
+        }
+    }
+}
+
+void odbc_prepared_statement_impl::close_cursor_()
+{
+    SQLCloseCursor(hstmt_);
+    SQLFreeStmt(hstmt_, SQL_UNBIND);
+    bound_columns_.clear();
+}
+
+// Parameters and the described result columns stay bound, 
+// their buffers belong to the statement
+
+void odbc_prepared_statement_impl::reset_()
+{
+    SQLFreeStmt(hstmt_, SQL_CLOSE);
+    if (!bound_columns_.empty())
+    {
+        SQLFreeStmt(hstmt_, SQL_UNBIND);
+        bound_columns_.clear();
+    }
+    row_array_size_ = initial_row_array_size_;
+}
+
+void odbc_prepared_statement_impl::refresh_columns_()
+{
+    reset_rowset();
+    columns_described_ = false;
+}
+
+void odbc_prepared_statement_impl::describe_(statement_metadata& metadata, std::error_code& ec)
+{
+    SQLSMALLINT numParams = 0;
+    RETCODE rc = SQLNumParams(hstmt_, &numParams);
+    if (rc == SQL_ERROR)
+    {
+        handle_diagnostic_record(hstmt_, SQL_HANDLE_STMT, rc, ec);
+        return;
+    }
+    metadata.num_parameters = numParams;
+
+    std::vector<column_description> columns;
+    describe_columns(hstmt_, utf8_, columns, ec);
+    if (ec)
+    {
+        return;
+    }
+    metadata.column_names.clear();
+    for (auto& column : columns)
+    {
+        metadata.column_names.push_back(std::move(column.name));
+    }
+}
+
+size_t odbc_prepared_statement_impl::column_index_(std::string_view name, std::error_code& ec)
+{
+    if (!columns_described_)
+    {
+        std::vector<column_description> columns;
+        describe_columns(hstmt_, utf8_, columns, ec);
+        if (ec)
+        {
+            return 0;
+        }
+        std::vector<std::string> names;
+        for (auto& column : columns)
+        {
+            names.push_back(std::move(column.name));
+        }
+        columns_.assign(std::move(names));
+        columns_described_ = true;
+    }
+
+    size_t i = columns_.find(name);
+    if (i != column_index::npos)
+    {
+        return i+1;
+    }
+    ec = make_error_code(odbc_errc::E_42S22);
+    return 0;
+}
+
+// compare_states
+
+struct compare_states
+{
+    bool operator()(const char* key1, const char* key2) const
+    {
+        return strncmp(key1, key2, 5) < 0;
+    }
+};
+
+struct odbc_error_codes
+{
+    std::map<const char*,odbc_errc,compare_states> code_map;
 
     odbc_error_codes()
     {
-        code_map[L"01000"] = odbc_errc::E_01000;
-        code_map[L"01001"] = odbc_errc::E_01001;
-        code_map[L"01003"] = odbc_errc::E_01003;
-        code_map[L"01004"] = odbc_errc::E_01004;
-        code_map[L"01006"] = odbc_errc::E_01006;
-        code_map[L"01007"] = odbc_errc::E_01007;
-        code_map[L"01S02"] = odbc_errc::E_01S02; 
-        code_map[L"07002"] = odbc_errc::E_07002;
-        code_map[L"07006"] = odbc_errc::E_07006;
-        code_map[L"07007"] = odbc_errc::E_07007;
-        code_map[L"07S01"] = odbc_errc::E_07S01;
-        code_map[L"08S01"] = odbc_errc::E_08S01;
-        code_map[L"21S02"] = odbc_errc::E_21S02;
-        code_map[L"22001"] = odbc_errc::E_22001;
-        code_map[L"22002"] = odbc_errc::E_22002;
-        code_map[L"22003"] = odbc_errc::E_22003;
-        code_map[L"22007"] = odbc_errc::E_22007;
-        code_map[L"22008"] = odbc_errc::E_22008;
-        code_map[L"22012"] = odbc_errc::E_22012;
-        code_map[L"22015"] = odbc_errc::E_22015;
-        code_map[L"22018"] = odbc_errc::E_22018;
-        code_map[L"22019"] = odbc_errc::E_22019;
-        code_map[L"22025"] = odbc_errc::E_22025;
-        code_map[L"23000"] = odbc_errc::E_23000;
-        code_map[L"24000"] = odbc_errc::E_24000;
-        code_map[L"40001"] = odbc_errc::E_40001;
-        code_map[L"40003"] = odbc_errc::E_40003;
-        code_map[L"42000"] = odbc_errc::E_42000;
-        code_map[L"42S02"] = odbc_errc::E_42S02;
-        code_map[L"44000"] = odbc_errc::E_44000;
-        code_map[L"HY000"] = odbc_errc::E_HY000;
-        code_map[L"HY001"] = odbc_errc::E_HY001;
-        code_map[L"HY008"] = odbc_errc::E_HY008;
-        code_map[L"HY009"] = odbc_errc::E_HY009; //
-        code_map[L"HY010"] = odbc_errc::E_HY010;
-        code_map[L"HY013"] = odbc_errc::E_HY013;
-        code_map[L"HY024"] = odbc_errc::E_HY024; //
-        code_map[L"HY090"] = odbc_errc::E_HY090; //
-        code_map[L"HY092"] = odbc_errc::E_HY092; //
-        code_map[L"HY104"] = odbc_errc::E_HY104;
-        code_map[L"HY117"] = odbc_errc::E_HY117;
-        code_map[L"HYT01"] = odbc_errc::E_HYT01;
-        code_map[L"HYC00"] = odbc_errc::E_HYC00; //
-        code_map[L"IM001"] = odbc_errc::E_IM001;
-        code_map[L"IM017"] = odbc_errc::E_IM017;
-        code_map[L"IM018"] = odbc_errc::E_IM018;
-        code_map[L"42S22"] = odbc_errc::E_42S22;
-    }
-
-    std::error_code get_error_code(const wchar_t* state)
+        code_map["01000"] = odbc_errc::E_01000;
+        code_map["01001"] = odbc_errc::E_01001;
+        code_map["01003"] = odbc_errc::E_01003;
+        code_map["01004"] = odbc_errc::E_01004;
+        code_map["01006"] = odbc_errc::E_01006;
+        code_map["01007"] = odbc_errc::E_01007;
+        code_map["01S02"] = odbc_errc::E_01S02; 
+        code_map["07002"] = odbc_errc::E_07002;
+        code_map["07006"] = odbc_errc::E_07006;
+        code_map["07007"] = odbc_errc::E_07007;
+        code_map["07S01"] = odbc_errc::E_07S01;
+        code_map["08S01"] = odbc_errc::E_08S01;
+        code_map["21S02"] = odbc_errc::E_21S02;
+        code_map["22001"] = odbc_errc::E_22001;
+        code_map["22002"] = odbc_errc::E_22002;
+        code_map["22003"] = odbc_errc::E_22003;
+        code_map["22007"] = odbc_errc::E_22007;
+        code_map["22008"] = odbc_errc::E_22008;
+        code_map["22012"] = odbc_errc::E_22012;
+        code_map["22015"] = odbc_errc::E_22015;
+        code_map["22018"] = odbc_errc::E_22018;
+        code_map["22019"] = odbc_errc::E_22019;
+        code_map["22025"] = odbc_errc::E_22025;
+        code_map["23000"] = odbc_errc::E_23000;
+        code_map["24000"] = odbc_errc::E_24000;
+        code_map["40001"] = odbc_errc::E_40001;
+        code_map["40003"] = odbc_errc::E_40003;
+        code_map["42000"] = odbc_errc::E_42000;
+        code_map["42S02"] = odbc_errc::E_42S02;
+        code_map["44000"] = odbc_errc::E_44000;
+        code_map["HY000"] = odbc_errc::E_HY000;
+        code_map["HY001"] = odbc_errc::E_HY001;
+        code_map["HY008"] = odbc_errc::E_HY008;
+        code_map["HY009"] = odbc_errc::E_HY009; //
+        code_map["HY010"] = odbc_errc::E_HY010;
+        code_map["HY013"] = odbc_errc::E_HY013;
+        code_map["HY024"] = odbc_errc::E_HY024; //
+        code_map["HY090"] = odbc_errc::E_HY090; //
+        code_map["HY092"] = odbc_errc::E_HY092; //
+        code_map["HY104"] = odbc_errc::E_HY104;
+        code_map["HY117"] = odbc_errc::E_HY117;
+        code_map["HYT01"] = odbc_errc::E_HYT01;
+        code_map["HYC00"] = odbc_errc::E_HYC00; //
+        code_map["IM001"] = odbc_errc::E_IM001;
+        code_map["IM017"] = odbc_errc::E_IM017;
+        code_map["IM018"] = odbc_errc::E_IM018;
+        code_map["42S22"] = odbc_errc::E_42S22;
+        code_map["HY003"] = odbc_errc::E_HY003;
+    }
+
+    std::error_code get_error_code(const char* state)
     {
         auto it = code_map.find(state);
         odbc_errc ec = (it == code_map.end()) ? odbc_errc::db_err : it->second;
@@ -1373,213 +3180,148 @@ void handle_diagnostic_record(SQLHANDLE      hHandle,
 
     SQLSMALLINT iRec = 0; 
     SQLINTEGER  iError; 
-    WCHAR       wszMessage[1000]; 
-    WCHAR       wszState[SQL_SQLSTATE_SIZE+1]; 
+    SQLWCHAR    wszMessage[1000]; 
+    SQLWCHAR    wszState[SQL_SQLSTATE_SIZE+1]; 
+    char        state[SQL_SQLSTATE_SIZE+1]; 
  
  
     if (RetCode == SQL_INVALID_HANDLE) 
     { 
         ec = make_error_code(odbc_errc::db_err);
-        fwprintf(stderr, L"Invalid handle!\n"); 
+        fprintf(stderr, "Invalid handle!\n"); 
         return; 
     } 
  
-    while (SQLGetDiagRec(hType, 
-                         hHandle, 
-                         ++iRec, 
-                         wszState, 
-                         &iError, 
-                         wszMessage, 
-                         (SQLSMALLINT)(sizeof(wszMessage) / sizeof(WCHAR)), 
-                         (SQLSMALLINT *)NULL) == SQL_SUCCESS) 
+    while (SQLGetDiagRecW(hType, 
+                          hHandle, 
+                          ++iRec, 
+                          wszState, 
+                          &iError, 
+                          wszMessage, 
+                          (SQLSMALLINT)(sizeof(wszMessage) / sizeof(SQLWCHAR)), 
+                          (SQLSMALLINT *)NULL) == SQL_SUCCESS) 
     { 
+        // SQLSTATE values are ASCII
+        for (size_t i = 0; i < SQL_SQLSTATE_SIZE+1; ++i)
+        {
+            state[i] = (char)wszState[i];
+        }
         // Hide data truncated.. 
-        if (!wcsncmp(wszState, L"01004", 5)) 
+        if (strncmp(state, "01004", 5) != 0) 
         { 
-            //fwprintf(stderr, L"[%5.5s] %s (%d)\n", wszState, wszMessage, iError); 
-        }
-        else
-        {
-            //fwprintf(stderr, L"[%5.5s] %s (%d)\n", wszState, wszMessage, iError); 
-            ec = error_codes.get_error_code(wszState);
+            ec = error_codes.get_error_code(state);
             break;
         }
     } 
 } 
 
-void process_results(SQLHSTMT hstmt,
-                     const std::function<void(const row& rec)>& callback,
-                     std::error_code& ec)
+void rowset::fetch_batches(SQLHSTMT hstmt,
+                           size_t batch_size,
+                           const std::function<void(const record_batch& batch)>& callback,
+                           std::error_code& ec)
 {
     RETCODE rc;
 
-    SQLSMALLINT numColumns; 
-    rc = SQLNumResultCols(hstmt,&numColumns);
-    if (rc == SQL_ERROR)
+    record_batch batch;
+    for (size_t i = 0; i < values_.size(); ++i)
     {
-        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
-        return;
+        batch.add_column(std::string(index_.name(i)), values_[i]->type());
     }
-    //std::cout << "numColumns = " << numColumns << std::endl;
-    std::vector<std::unique_ptr<value_impl>> values;
-    values.reserve(numColumns);
-    if (numColumns > 0) 
-    { 
-        for (SQLUSMALLINT col = 1; col <= numColumns; col++) 
-        { 
-            WCHAR name[SQL_MAX_COLUMN_NAME_LEN];
-
-            SQLSMALLINT nameLength;
-            SQLSMALLINT dataType;
-            SQLULEN column_size;
-            SQLSMALLINT decimalDigits;
-            SQLSMALLINT nullable;
-            SQLDescribeCol(hstmt,  
-                           col,  
-                           name,  
-                           SQL_MAX_COLUMN_NAME_LEN,  
-                           &nameLength,  
-                           &dataType,  
-                           &column_size,  
-                           &decimalDigits,  
-                           &nullable);  
-
-            //std::wcout << std::wstring(&name[0],nameLength) << " column_size: " << column_size << " int32_t size: " << sizeof(int32_t) << std::endl;
-            switch (dataType)
+
+    bool done = false;
+    while (!done)
+    {
+        rows_fetched_ = 0;
+        rc = SQLFetch(hstmt);
+        if (rc == SQL_ERROR)
+        {
+            handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
+            return;
+        }
+        if (rc == SQL_NO_DATA)
+        {
+            done = true;
+        }
+        else
+        {
+            // Get long data values here (the rowset is then a single row)
+            for (auto& value : values_)
             {
-            case SQL_DATE:
-            case SQL_TYPE_DATE:
-            case SQL_TYPE_TIMESTAMP:
+                value->get_data(hstmt,ec);
+                if (ec)
                 {
-                    SQLLEN displaySize = 0; 
-                    rc = SQLColAttribute(hstmt, 
-                                         col, 
-                                         SQL_DESC_DISPLAY_SIZE, 
-                                         NULL, 
-                                         0, 
-                                         NULL, 
-                                         &displaySize);
-                    if (rc == SQL_ERROR)
-                    {
-                        handle_diagnostic_record(hstmt, SQL_HANDLE_STMT, rc, ec);
-                        return;
-                    }
-                    std::wcout << std::wstring(&name[0],nameLength) << L" " << L"date/timestamp" << std::endl;
-                    values.push_back(std::make_unique<string_value>(std::wstring(name,nameLength),
-                                                                    col,
-                                                                    (SQLULEN)(displaySize),
-                                                                    nullable));
-                    values.back()->bind(hstmt, ec);
+                    return;
                 }
-                //std::wcout << std::wstring(&name[0],nameLength) << " " << "SQL_TYPE_TIMESTAMP" << std::endl;
-                break;
-            case SQL_VARCHAR:
-            case SQL_CHAR:
-                std::wcout << std::wstring(&name[0],nameLength) << L" " << L"char" << std::endl;
-                values.push_back(std::make_unique<string_value>(std::wstring(&name[0],nameLength),
-                                                                col,
-                                                                column_size,
-                                                                nullable));
-                values.back()->bind(hstmt, ec);
-                break;
-            case SQL_LONGVARCHAR:
-                //std::wcout << std::wstring(&name[0],nameLength) << " " << "wchar" << std::endl;
-                values.push_back(std::make_unique<long_string_value>(std::wstring(&name[0],nameLength),
-                                                                     col,
-                                                                     nullable));
-                values.back()->bind(hstmt, ec);
-                break;
-            case SQL_WVARCHAR:
-            case SQL_WCHAR:
-                //std::wcout << std::wstring(&name[0],nameLength) << L" " << L"wchar" << std::endl;
-                values.push_back(std::make_unique<wstring_value>(std::wstring(&name[0],nameLength),
-                                                                 col,
-                                                                 column_size,
-                                                                 nullable));
-                values.back()->bind(hstmt, ec);
-                break;
-            case SQL_WLONGVARCHAR:
-                //std::wcout << std::wstring(&name[0],nameLength) << " " << "wchar" << std::endl;
-                values.push_back(std::make_unique<long_wstring_value>(std::wstring(&name[0],nameLength),
-                                                                      col,
-                                                                      nullable));
-                values.back()->bind(hstmt, ec);
-                break;
-            case SQL_SMALLINT:
-            case SQL_TINYINT:
-            case SQL_INTEGER:
-            case SQL_BIGINT:
-                //std::wcout << std::wstring(&name[0], nameLength) << " " << "BIGINT" << std::endl;
-                values.push_back(std::make_unique<integer_value>(std::wstring(&name[0],nameLength),
-                                                                 col,
-                                                                 column_size,
-                                                                 nullable));
-                values.back()->bind(hstmt, ec);
-                break;
-            case SQL_DECIMAL:
-            case SQL_NUMERIC:
-            case SQL_REAL:
-            case SQL_FLOAT:
-            case SQL_DOUBLE:
-                values.push_back(std::make_unique<double_value>(std::wstring(&name[0],nameLength),
-                                                                col,
-                                                                column_size,
-                                                                nullable));
-                //std::wcout << std::wstring(&name[0],nameLength) << " " << "Float" << std::endl;
-                values.back()->bind(hstmt, ec);
-                break;
-            default:
-                //std::wcout << std::wstring(&name[0],nameLength) << ", dataType= " << dataType << std::endl;
-                break;
             }
-        }
-
-    }  
-    if (numColumns > 0) 
-    { 
-        bool fNoData = false; 
-
-        std::vector<value*> cols;
-        cols.reserve(values.size());
-        for (auto& c : values)
-        {
-            cols.push_back(c.get());
-        }
-
-        row rec(std::move(cols));
-
-        do { 
-            // Fetch a row 
-
-            rc = SQLFetch(hstmt);
-            if (rc == SQL_ERROR)
+            size_t offset = batch.num_rows();
+            for (size_t i = 0; i < values_.size(); ++i)
             {
-                ec = make_error_code(odbc_errc::db_err);
-                return;
+                values_[i]->append_to(batch[i], rows_fetched_, ec);
+                if (ec)
+                {
+                    return;
+                }
             }
-
-            if (rc == SQL_SUCCESS) 
-            { 
-                // Get long data values here
-                for (size_t i = 0; i < rec.size(); ++i)
+            for (SQLULEN j = 0; j < rows_fetched_; ++j)
+            {
+                if (row_status_[j] == SQL_ROW_ERROR || row_status_[j] == SQL_ROW_NOROW)
                 {
-                    value_impl& c = static_cast<value_impl&>(rec[i]);
-                    c.get_data(hstmt,ec);
-                    if (ec)
+                    for (size_t i = 0; i < values_.size(); ++i)
                     {
-                        return;
+                        batch[i].set_null(offset + j);
                     }
                 }
-                callback(rec);
-            } 
-            else 
-            { 
-                fNoData = true; 
             }
+            if (batch.num_rows() >= batch_size)
+            {
+                callback(batch);
+                batch.clear();
+            }
+        }
+    }
+    if (batch.num_rows() > 0)
+    {
+        callback(batch);
+    }
+}
 
-        } 
-        while (!fNoData); 
-        rc = SQLCloseCursor(hstmt);
+void process_results(SQLHSTMT hstmt,
+                     size_t row_array_size,
+                     bool utf8,
+                     const std::function<void(const row& rec)>& callback,
+                     std::error_code& ec)
+{
+    rowset rs(row_array_size, utf8);
+    rs.describe(hstmt, ec);
+    if (ec || rs.num_columns() == 0)
+    {
+        return;
+    }
+    rowset::binding_guard guard(rs, hstmt);
+    rs.bind(hstmt, ec);
+    if (!ec)
+    {
+        rs.fetch(hstmt, callback, ec);
+    }
+}
+
+void process_batches(SQLHSTMT hstmt,
+                     size_t batch_size,
+                     bool utf8,
+                     const std::function<void(const record_batch& batch)>& callback,
+                     std::error_code& ec)
+{
+    rowset rs(batch_size, utf8);
+    rs.describe(hstmt, ec);
+    if (ec || rs.num_columns() == 0)
+    {
+        return;
+    }
+    rowset::binding_guard guard(rs, hstmt);
+    rs.bind(hstmt, ec);
+    if (!ec)
+    {
+        rs.fetch_batches(hstmt, batch_size, callback, ec);
     }
 }
 
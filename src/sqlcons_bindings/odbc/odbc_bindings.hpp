@@ -56,7 +56,8 @@ enum class odbc_errc
     E_IM001,
     E_IM017,
     E_IM018,
-    E_42S22
+    E_42S22,
+    E_HY003
 };
 
 class odbc_error_category_impl
@@ -74,10 +75,44 @@ const std::error_category& odbc_error_category();
 
 std::error_code make_error_code(odbc_errc result);
 
+// Serialization failure or deadlock (40001), or a connection timeout (HYT01)
+bool is_transient_error(const std::error_code& ec);
+
+// Connections share one ODBC environment, allocated when needed and freed with the last 
+// connection. Sets the driver manager's process wide SQL_ATTR_CONNECTION_POOLING to 
+// SQL_CP_ONE_PER_HENV, or back to SQL_CP_OFF, which also affects other ODBC code in the 
+// process. It applies to environments allocated afterwards, so turn it on before opening 
+// connections. While pooling is on the shared environment is kept, and the connections 
+// pooled in it, until pooling is turned off and its last connection is closed.
+void driver_manager_pooling(bool on, std::error_code& ec);
+
+// Text is exchanged with the driver as UTF-16 (SQL_C_WCHAR)
 class odbc_bindings
 {
 public:
+    typedef char16_t char_type;
+
     static std::unique_ptr<connection_impl> create_connection(const std::string& connString, std::error_code& ec);
+
+    static bool is_transient(const std::error_code& ec)
+    {
+        return is_transient_error(ec);
+    }
+};
+
+// Text is exchanged with the driver as UTF-8 (SQL_C_CHAR) without transcoding, 
+// for drivers that accept UTF-8 natively
+class odbc_utf8_bindings
+{
+public:
+    typedef char char_type;
+
+    static std::unique_ptr<connection_impl> create_connection(const std::string& connString, std::error_code& ec);
+
+    static bool is_transient(const std::error_code& ec)
+    {
+        return is_transient_error(ec);
+    }
 };
 
 }}